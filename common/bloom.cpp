@@ -0,0 +1,166 @@
+#include "bloom.h"
+
+#include <math.h>
+
+// Choose the number of probes that minimizes the false positive rate
+static int optimal_probes(double bits_per_key)
+{
+	int result = (int)(bits_per_key*0.69314718 + 0.5);
+	if (result < 1)
+		return 1;
+	if (result > 16)
+		return 16;
+	return result;
+}
+
+// Map the upper half of the digest onto [0, num_blocks) without a divide
+static size_t block_of(uint64_t hash, size_t num_blocks)
+{
+	return (size_t)(((hash >> 32)*(uint64_t)num_blocks) >> 32);
+}
+
+// Probe i lands on (a + i*b) within the block, where a and b come from the
+// lower half of the digest remixed (Kirsch and Mitzenmacher). b is odd, so
+// the probes of one key never repeat within a power of two block.
+struct probe_sequence
+{
+	probe_sequence(uint64_t hash)
+	{
+		uint64_t mixed = (hash & 0xFFFFFFFF)*hasher::prime1;
+		a = (uint32_t)(mixed >> 32);
+		b = (uint32_t)mixed | 1;
+	}
+
+	uint32_t a;
+	uint32_t b;
+
+	uint32_t next()
+	{
+		uint32_t result = a;
+		a += b;
+		return result;
+	}
+};
+
+bloom_filter::bloom_filter(size_t expected, double bits_per_key)
+{
+	reset(expected, bits_per_key);
+}
+
+bloom_filter::~bloom_filter()
+{
+}
+
+void bloom_filter::reset(size_t expected, double bits_per_key)
+{
+	num_blocks = (size_t)ceil((double)expected*bits_per_key/512.0);
+	if (num_blocks < 1)
+		num_blocks = 1;
+	num_probes = optimal_probes(bits_per_key);
+	words.assign(num_blocks*8, 0);
+}
+
+void bloom_filter::clear()
+{
+	fill(words.begin(), words.end(), 0);
+}
+
+void bloom_filter::insert_hash(uint64_t hash)
+{
+	uint64_t *block = words.data() + block_of(hash, num_blocks)*8;
+	probe_sequence probe(hash);
+	for (int i = 0; i < num_probes; i++)
+	{
+		uint32_t bit = probe.next() & 511;
+		block[bit >> 6] |= (uint64_t)1 << (bit & 63);
+	}
+}
+
+bool bloom_filter::may_contain_hash(uint64_t hash) const
+{
+	const uint64_t *block = words.data() + block_of(hash, num_blocks)*8;
+	probe_sequence probe(hash);
+	for (int i = 0; i < num_probes; i++)
+	{
+		uint32_t bit = probe.next() & 511;
+		if ((block[bit >> 6] & ((uint64_t)1 << (bit & 63))) == 0)
+			return false;
+	}
+	return true;
+}
+
+size_t bloom_filter::bytes() const
+{
+	return words.size()*sizeof(uint64_t);
+}
+
+counting_bloom_filter::counting_bloom_filter(size_t expected, double counters_per_key)
+{
+	reset(expected, counters_per_key);
+}
+
+counting_bloom_filter::~counting_bloom_filter()
+{
+}
+
+void counting_bloom_filter::reset(size_t expected, double counters_per_key)
+{
+	num_blocks = (size_t)ceil((double)expected*counters_per_key/128.0);
+	if (num_blocks < 1)
+		num_blocks = 1;
+	num_probes = optimal_probes(counters_per_key);
+	words.assign(num_blocks*8, 0);
+}
+
+void counting_bloom_filter::clear()
+{
+	fill(words.begin(), words.end(), 0);
+}
+
+void counting_bloom_filter::insert_hash(uint64_t hash)
+{
+	uint64_t *block = words.data() + block_of(hash, num_blocks)*8;
+	probe_sequence probe(hash);
+	for (int i = 0; i < num_probes; i++)
+	{
+		uint32_t counter = probe.next() & 127;
+		uint64_t &word = block[counter >> 4];
+		int shift = (counter & 15)*4;
+		if (((word >> shift) & 15) != 15)
+			word += (uint64_t)1 << shift;
+	}
+}
+
+bool counting_bloom_filter::may_contain_hash(uint64_t hash) const
+{
+	const uint64_t *block = words.data() + block_of(hash, num_blocks)*8;
+	probe_sequence probe(hash);
+	for (int i = 0; i < num_probes; i++)
+	{
+		uint32_t counter = probe.next() & 127;
+		if (((block[counter >> 4] >> ((counter & 15)*4)) & 15) == 0)
+			return false;
+	}
+	return true;
+}
+
+void counting_bloom_filter::erase_hash(uint64_t hash)
+{
+	uint64_t *block = words.data() + block_of(hash, num_blocks)*8;
+	probe_sequence probe(hash);
+	for (int i = 0; i < num_probes; i++)
+	{
+		uint32_t counter = probe.next() & 127;
+		uint64_t &word = block[counter >> 4];
+		int shift = (counter & 15)*4;
+		uint64_t value = (word >> shift) & 15;
+		// Saturated counters have lost track of how many keys they hold
+		if (value != 0 && value != 15)
+			word -= (uint64_t)1 << shift;
+	}
+}
+
+size_t counting_bloom_filter::bytes() const
+{
+	return words.size()*sizeof(uint64_t);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "hash.h"
+
+// Probabilistic set membership. A filter never reports a false negative,
+// so placing one in front of an expensive lookup lets most misses be
+// rejected without touching the underlying container.
+//
+// Both filters are blocked: the digest of a key picks one 64-byte block,
+// and every probe for that key lands inside it. A query therefore touches
+// a single cache line. All probes are derived from the one 64-bit hasher
+// digest of the key, so keys are only hashed once.
+
+// A blocked Bloom filter with a configurable number of bits per key
+struct bloom_filter
+{
+	bloom_filter(size_t expected = 0, double bits_per_key = 10.0);
+	~bloom_filter();
+
+	// blocks of 512 bits
+	vector<uint64_t> words;
+	size_t num_blocks;
+	int num_probes;
+
+	void reset(size_t expected, double bits_per_key = 10.0);
+	void clear();
+
+	void insert_hash(uint64_t hash);
+	bool may_contain_hash(uint64_t hash) const;
+
+	template <class type>
+	void insert(const type &key)
+	{
+		insert_hash(hasher(&key).get64());
+	}
+
+	template <class type>
+	bool may_contain(const type &key) const
+	{
+		return may_contain_hash(hasher(&key).get64());
+	}
+
+	size_t bytes() const;
+};
+
+// A blocked counting Bloom filter that also supports erase. Each position
+// holds a four bit counter in place of a single bit. A counter that
+// overflows sticks at its maximum so that erase can never introduce a
+// false negative.
+struct counting_bloom_filter
+{
+	counting_bloom_filter(size_t expected = 0, double counters_per_key = 10.0);
+	~counting_bloom_filter();
+
+	// blocks of 128 four bit counters
+	vector<uint64_t> words;
+	size_t num_blocks;
+	int num_probes;
+
+	void reset(size_t expected, double counters_per_key = 10.0);
+	void clear();
+
+	void insert_hash(uint64_t hash);
+	bool may_contain_hash(uint64_t hash) const;
+	// Only erase keys that were inserted
+	void erase_hash(uint64_t hash);
+
+	template <class type>
+	void insert(const type &key)
+	{
+		insert_hash(hasher(&key).get64());
+	}
+
+	template <class type>
+	bool may_contain(const type &key) const
+	{
+		return may_contain_hash(hasher(&key).get64());
+	}
+
+	template <class type>
+	void erase(const type &key)
+	{
+		erase_hash(hasher(&key).get64());
+	}
+
+	size_t bytes() const;
+};
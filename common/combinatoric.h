@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <cstddef>
 
 struct CombinatoricIterator {
 	std::vector<size_t> indices;
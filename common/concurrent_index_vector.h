@@ -0,0 +1,319 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <bit>
+#include <memory>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "index_vector.h"
+
+// concurrent_index_vector is an index_vector that many threads may emplace
+// into and erase from at once, for building element tables in parallel.
+// Slots are laid out in the same doubling blocks as index_segments. The
+// block table has a fixed size and each block is published with a single
+// compare and swap, so elements never move and a new slot only costs an
+// atomic increment of the bump pointer. Validity is kept in atomic words
+// alongside each block. As in index_vector, blocks are raw memory, and an
+// element is constructed when it is emplaced and destroyed when it is
+// erased.
+//
+// Freed slots go to one of num_stripes free lists picked by the calling
+// thread, so threads reuse their own slots without contending with each
+// other. A thread only looks at the other stripes when its own is empty
+// and some other thread has freed a slot.
+//
+// emplace, erase, is_valid and at may be called from any thread. Reading an
+// element while another thread erases it is a race, the same as for any
+// container. size, count, clear and iteration are only meaningful at
+// quiescent points when no thread is modifying the table.
+template<typename T, int num_stripes = 16>
+struct concurrent_index_vector {
+	using value_type = T;
+	using size_type = std::size_t;
+	using segments = index_segments<T>;
+
+	static constexpr size_type max_blocks = 8*sizeof(size_type) - segments::base_bits;
+
+	struct block {
+		block(size_type size) : elems(index_raw_allocate<T>(size)), live(new std::atomic<uint64_t>[size/64]), words(size/64) {
+			for (size_type w = 0; w < words; w++) {
+				live[w].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		~block() {
+			if constexpr (not std::is_trivially_destructible<T>::value) {
+				for (size_type w = 0; w < words; w++) {
+					uint64_t bits = live[w].load(std::memory_order_relaxed);
+					while (bits != 0) {
+						std::destroy_at(elems.get() + (w<<6) + std::countr_zero(bits));
+						bits &= bits - 1;
+					}
+				}
+			}
+		}
+
+		index_raw_ptr<T> elems;
+		std::unique_ptr<std::atomic<uint64_t>[]> live;
+		size_type words;
+	};
+
+	// Keep every stripe on its own cache line
+	struct alignas(64) stripe {
+		std::mutex lock;
+		std::vector<size_type> free;
+	};
+
+	std::array<std::atomic<block*>, max_blocks> blocks;
+	std::atomic<size_type> length;
+	// the number of slots waiting in the free lists
+	std::atomic<size_type> freed;
+	std::array<stripe, num_stripes> stripes;
+
+	concurrent_index_vector() {
+		for (auto &b : blocks) {
+			b.store(nullptr, std::memory_order_relaxed);
+		}
+		length.store(0, std::memory_order_relaxed);
+		freed.store(0, std::memory_order_relaxed);
+	}
+
+	concurrent_index_vector(const concurrent_index_vector &) = delete;
+	concurrent_index_vector &operator=(const concurrent_index_vector &) = delete;
+
+	~concurrent_index_vector() {
+		for (auto &b : blocks) {
+			delete b.load(std::memory_order_relaxed);
+		}
+	}
+
+	static size_type stripe_of_thread() {
+		static std::atomic<size_type> threads(0);
+		static thread_local size_type id = threads.fetch_add(1, std::memory_order_relaxed);
+		return id%num_stripes;
+	}
+
+	// Return block b, allocating it if no thread has yet
+	block *get_block(size_type b) {
+		block *result = blocks[b].load(std::memory_order_acquire);
+		if (result == nullptr) {
+			block *fresh = new block(segments::block_size(b));
+			if (blocks[b].compare_exchange_strong(result, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+				result = fresh;
+			} else {
+				delete fresh;
+			}
+		}
+		return result;
+	}
+
+	const block *find_block(size_type i) const {
+		return blocks[segments::block_of(i)].load(std::memory_order_acquire);
+	}
+
+	bool pop_free(stripe &s, size_type &i) {
+		if (s.free.empty()) {
+			return false;
+		}
+		i = s.free.back();
+		s.free.pop_back();
+		freed.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Take a freed slot, preferring this thread's own stripe
+	bool reuse(size_type &i) {
+		if (freed.load(std::memory_order_relaxed) == 0) {
+			return false;
+		}
+
+		size_type home = stripe_of_thread();
+		{
+			std::lock_guard<std::mutex> guard(stripes[home].lock);
+			if (pop_free(stripes[home], i)) {
+				return true;
+			}
+		}
+
+		for (size_type k = 1; k < (size_type)num_stripes; k++) {
+			stripe &s = stripes[(home + k)%num_stripes];
+			std::unique_lock<std::mutex> guard(s.lock, std::try_to_lock);
+			if (guard.owns_lock() and pop_free(s, i)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Hand slot i to this thread's free list
+	void release(size_type i) {
+		stripe &s = stripes[stripe_of_thread()];
+		std::lock_guard<std::mutex> guard(s.lock);
+		s.free.push_back(i);
+		freed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	template<typename... Args>
+	size_type emplace(Args&&... args) {
+		size_type i;
+		if (not reuse(i)) {
+			i = length.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		size_type b = segments::block_of(i);
+		size_type offset = segments::offset_of(i, b);
+		try {
+			block *blk = get_block(b);
+			::new ((void*)(blk->elems.get() + offset)) T(std::forward<Args>(args)...);
+			blk->live[offset>>6].fetch_or(uint64_t(1) << (offset&63), std::memory_order_release);
+		} catch (...) {
+			// The slot was never made live, so it is free for the next emplace
+			release(i);
+			throw;
+		}
+		return i;
+	}
+
+	size_type insert(const T &value) {
+		return emplace(value);
+	}
+
+	bool erase(size_type i) {
+		if (i >= length.load(std::memory_order_acquire)) {
+			return false;
+		}
+		size_type b = segments::block_of(i);
+		size_type offset = segments::offset_of(i, b);
+		block *blk = blocks[b].load(std::memory_order_acquire);
+		if (blk == nullptr) {
+			return false;
+		}
+
+		uint64_t bit = uint64_t(1) << (offset&63);
+		if (not (blk->live[offset>>6].fetch_and(~bit, std::memory_order_acq_rel) & bit)) {
+			return false;
+		}
+
+		std::destroy_at(blk->elems.get() + offset);
+		release(i);
+		return true;
+	}
+
+	bool is_valid(size_type i) const {
+		if (i >= length.load(std::memory_order_acquire)) {
+			return false;
+		}
+		const block *blk = find_block(i);
+		if (blk == nullptr) {
+			return false;
+		}
+		size_type offset = segments::offset_of(i, segments::block_of(i));
+		return (blk->live[offset>>6].load(std::memory_order_acquire) >> (offset&63)) & 1;
+	}
+
+	// The element at slot i, which must be live
+	T &slot(size_type i) {
+		size_type b = segments::block_of(i);
+		return blocks[b].load(std::memory_order_acquire)->elems.get()[segments::offset_of(i, b)];
+	}
+
+	const T &slot(size_type i) const {
+		size_type b = segments::block_of(i);
+		return blocks[b].load(std::memory_order_acquire)->elems.get()[segments::offset_of(i, b)];
+	}
+
+	T &at(size_type i) {
+		if (not is_valid(i)) throw std::out_of_range("concurrent_index_vector::at() invalid index");
+		return slot(i);
+	}
+
+	const T &at(size_type i) const {
+		if (not is_valid(i)) throw std::out_of_range("concurrent_index_vector::at() invalid index");
+		return slot(i);
+	}
+
+	T &operator[](size_type i) {
+		return at(i);
+	}
+
+	const T &operator[](size_type i) const {
+		return at(i);
+	}
+
+	size_type size() const {
+		return length.load(std::memory_order_acquire);
+	}
+
+	size_type count() const {
+		return size() - freed.load(std::memory_order_acquire);
+	}
+
+	void clear() {
+		for (auto &b : blocks) {
+			delete b.exchange(nullptr, std::memory_order_acq_rel);
+		}
+		for (auto &s : stripes) {
+			s.free.clear();
+		}
+		length.store(0, std::memory_order_release);
+		freed.store(0, std::memory_order_release);
+	}
+
+	// The first live slot at or after i, or size() if there is none
+	size_type next(size_type i) const {
+		size_type n = size();
+		while (i < n) {
+			size_type b = segments::block_of(i);
+			size_type offset = segments::offset_of(i, b);
+			const block *blk = blocks[b].load(std::memory_order_acquire);
+			if (blk == nullptr) {
+				i += segments::block_size(b) - offset;
+				continue;
+			}
+
+			uint64_t bits = blk->live[offset>>6].load(std::memory_order_acquire) & (~uint64_t(0) << (offset&63));
+			if (bits != 0) {
+				i += std::countr_zero(bits) - (offset&63);
+				return i < n ? i : n;
+			}
+			i += 64 - (offset&63);
+		}
+		return n;
+	}
+
+	template <bool isConst>
+	struct Iterator {
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using reference = std::conditional_t<isConst, const T&, T&>;
+		using pointer = std::conditional_t<isConst, const T*, T*>;
+		using difference_type = std::ptrdiff_t;
+		using parent_type = std::conditional_t<isConst, const concurrent_index_vector, concurrent_index_vector>;
+
+		size_type index;
+		parent_type *parent;
+
+		Iterator(parent_type *p, size_type i) : index(p->next(i)), parent(p) {}
+		reference operator*() const { return parent->slot(index); }
+		pointer operator->() const { return &parent->slot(index); }
+		Iterator& operator++() { index = parent->next(index+1); return *this; }
+		Iterator operator++(int) { Iterator tmp = *this; ++(*this); return tmp; }
+		bool operator==(const Iterator& other) const { return index == other.index; }
+		bool operator!=(const Iterator& other) const { return not (*this == other); }
+	};
+
+	using iterator = Iterator<false>;
+	using const_iterator = Iterator<true>;
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, size()); }
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, size()); }
+};
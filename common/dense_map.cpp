@@ -0,0 +1,74 @@
+#include "dense_map.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define DENSE_MAP_AVX2 1
+#endif
+
+static size_t denseMapGatherScalar(const uint32_t *slots, size_t num_slots, const uint32_t *from, size_t n, uint32_t *out, bool identity, uint32_t undef) {
+	size_t k = 0;
+	for (size_t i = 0; i < n; i++) {
+		uint32_t id = from[i];
+		if (id < num_slots and slots[2*(size_t)id] == id) {
+			if (slots[2*(size_t)id+1] != undef) {
+				out[k++] = slots[2*(size_t)id+1];
+			}
+		} else if (identity) {
+			out[k++] = id;
+		}
+	}
+	return k;
+}
+
+#ifdef DENSE_MAP_AVX2
+// Map eight ids at a time. Each lane gathers the key of its slot, and then
+// the value if the key matches. Lanes that are out of range or absent keep
+// their id in place of the value.
+__attribute__((target("avx2")))
+static size_t denseMapGatherAvx2(const uint32_t *slots, size_t num_slots, const uint32_t *from, size_t n, uint32_t *out, bool identity, uint32_t undef) {
+	const int *base = (const int*)slots;
+	__m256i limit = _mm256_set1_epi32((int)num_slots);
+	__m256i undefs = _mm256_set1_epi32((int)undef);
+	__m256i keepAbsent = _mm256_set1_epi32(identity ? -1 : 0);
+
+	size_t k = 0;
+	size_t i = 0;
+	for (; i+8 <= n; i += 8) {
+		__m256i ids = _mm256_loadu_si256((const __m256i*)(from+i));
+		// num_slots is below 2^30, so in range ids are non-negative as signed
+		__m256i inRange = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), ids), _mm256_cmpgt_epi32(limit, ids));
+		__m256i index = _mm256_add_epi32(ids, ids);
+		__m256i keys = _mm256_mask_i32gather_epi32(_mm256_xor_si256(ids, _mm256_set1_epi32(-1)), base, index, inRange, 4);
+		__m256i found = _mm256_and_si256(inRange, _mm256_cmpeq_epi32(keys, ids));
+		__m256i values = _mm256_mask_i32gather_epi32(ids, base+1, index, found, 4);
+
+		__m256i isUndef = _mm256_cmpeq_epi32(values, undefs);
+		__m256i keep = _mm256_or_si256(_mm256_andnot_si256(isUndef, found), _mm256_andnot_si256(found, keepAbsent));
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(keep));
+		if (mask == 0xFF) {
+			_mm256_storeu_si256((__m256i*)(out+k), values);
+			k += 8;
+		} else if (mask != 0) {
+			alignas(32) uint32_t lanes[8];
+			_mm256_store_si256((__m256i*)lanes, values);
+			for (int j = 0; j < 8; j++) {
+				if (mask & (1 << j)) {
+					out[k++] = lanes[j];
+				}
+			}
+		}
+	}
+
+	return k + denseMapGatherScalar(slots, num_slots, from+i, n-i, out+k, identity, undef);
+}
+#endif
+
+size_t denseMapGather32(const uint32_t *slots, size_t num_slots, const uint32_t *from, size_t n, uint32_t *out, bool identity, uint32_t undef) {
+#ifdef DENSE_MAP_AVX2
+	static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+	if (hasAvx2 and num_slots < ((size_t)1 << 30)) {
+		return denseMapGatherAvx2(slots, num_slots, from, n, out, identity, undef);
+	}
+#endif
+	return denseMapGatherScalar(slots, num_slots, from, n, out, identity, undef);
+}
@@ -0,0 +1,422 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <utility>
+#include <limits>
+#include <iterator>
+#include <type_traits>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+
+// Map n 32-bit ids through the slots of a dense DenseMap of 32-bit keys and
+// values, which are laid out as (key, value) pairs, writing the results to
+// out. An id with no slot maps to itself in an identity mapping and is
+// dropped otherwise, and ids that map to undef are dropped, the same as
+// Mapping::map(vector). Returns the number of ids written. out may be the
+// same array as from. Uses AVX2 gathers when the processor supports them.
+size_t denseMapGather32(const uint32_t *slots, size_t num_slots, const uint32_t *from, size_t n, uint32_t *out, bool identity, uint32_t undef);
+
+// DenseMap is a drop in replacement for std::map<T, V> over integral keys,
+// used as the forward map of Mapping. While the keys are small and
+// non-negative, the entry for key k lives in slots[k] of a flat array, so a
+// lookup is a single index. Slot k is present when slots[k].first == k, and
+// absent slots hold some other key. Inserting a key that is negative, or
+// too far past the end of the array for the number of entries, moves every
+// entry into a sparse std::map instead, as does erasing until most of the
+// array is dead. Once the keys are again non-negative and the largest is
+// small enough for the number of entries, and there have been at least as
+// many sparse inserts and erases as there are entries to pay for the move,
+// they move back into the array. Either way, iteration visits the entries
+// in increasing order of key.
+//
+// DenseMap<int> m;
+// m[3] = 5;        // dense, four slots
+// m[-1] = 2;       // sparse
+// m.erase(-1);     // dense again
+template <typename T, typename V = T>
+struct DenseMap {
+	static_assert(std::is_integral<T>::value, "DenseMap requires an integral key");
+
+	using key_type = T;
+	using mapped_type = V;
+	using value_type = std::pair<T, V>;
+	using size_type = std::size_t;
+	using sparse_type = std::map<T, value_type>;
+
+	// The array may run this many slots past twice the number of entries
+	// before a key is considered too large to store densely.
+	static constexpr size_t slack = 1024;
+
+	DenseMap() {
+		length = 0;
+		dense = true;
+		churn = 0;
+	}
+
+	~DenseMap() {
+	}
+
+	std::vector<value_type> slots;
+	sparse_type sparse;
+	size_t length;
+	bool dense;
+	// sparse inserts and erases since the entries last left the array
+	size_t churn;
+
+	template <bool isConst>
+	struct Iterator {
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = std::pair<T, V>;
+		using reference = std::conditional_t<isConst, const value_type&, value_type&>;
+		using pointer = std::conditional_t<isConst, const value_type*, value_type*>;
+		using difference_type = std::ptrdiff_t;
+		using parent_type = std::conditional_t<isConst, const DenseMap, DenseMap>;
+		using sparse_iterator = std::conditional_t<isConst, typename sparse_type::const_iterator, typename sparse_type::iterator>;
+
+		parent_type *parent;
+		size_t index;
+		sparse_iterator pos;
+
+		Iterator() : parent(nullptr), index(0) {}
+		Iterator(parent_type *p, size_t i) : parent(p), index(i) {}
+		Iterator(parent_type *p, sparse_iterator i) : parent(p), index(0), pos(i) {}
+
+		template <bool other, std::enable_if_t<isConst and not other, int> = 0>
+		Iterator(const Iterator<other> &i) : parent(i.parent), index(i.index), pos(i.pos) {}
+
+		void skip() {
+			while (index < parent->slots.size() and not parent->present(index)) {
+				++index;
+			}
+		}
+
+		reference operator*() const { return parent->dense ? parent->slots[index] : pos->second; }
+		pointer operator->() const { return &**this; }
+
+		Iterator &operator++() {
+			if (parent->dense) {
+				++index;
+				skip();
+			} else {
+				++pos;
+			}
+			return *this;
+		}
+
+		Iterator operator++(int) { Iterator tmp = *this; ++(*this); return tmp; }
+
+		Iterator &operator--() {
+			if (parent->dense) {
+				do {
+					--index;
+				} while (not parent->present(index));
+			} else {
+				--pos;
+			}
+			return *this;
+		}
+
+		Iterator operator--(int) { Iterator tmp = *this; --(*this); return tmp; }
+		bool operator==(const Iterator &other) const { return parent->dense ? index == other.index : pos == other.pos; }
+		bool operator!=(const Iterator &other) const { return not (*this == other); }
+	};
+
+	using iterator = Iterator<false>;
+	using const_iterator = Iterator<true>;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	bool present(size_t i) const {
+		return slots[i].first == T(i);
+	}
+
+	// Whether key indexes the current array
+	bool inRange(T key) const {
+		if constexpr (std::is_signed<T>::value) {
+			if (key < 0) {
+				return false;
+			}
+		}
+		return (size_t)key < slots.size();
+	}
+
+	// Grow the array to cover key if it may be stored densely. Returns false
+	// if it may not.
+	bool cover(T key) {
+		if (inRange(key)) {
+			return true;
+		}
+
+		size_t limit = (size_t)std::numeric_limits<T>::max();
+		if constexpr (std::is_signed<T>::value) {
+			if (key < 0) {
+				return false;
+			}
+		}
+		if ((size_t)key >= limit or (size_t)key >= 2*(length+1) + slack) {
+			return false;
+		}
+
+		size_t size = std::max((size_t)key + 1, std::min(2*slots.size(), limit));
+		slots.reserve(size);
+		for (size_t i = slots.size(); i < size; i++) {
+			slots.push_back(value_type(T(i+1), V()));
+		}
+		return true;
+	}
+
+	// Move every entry into the sparse map
+	void makeSparse() {
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (present(i)) {
+				sparse.emplace_hint(sparse.end(), slots[i].first, slots[i]);
+			}
+		}
+		std::vector<value_type>().swap(slots);
+		dense = false;
+		churn = 0;
+	}
+
+	// Drop the dead slots past the last entry, and move to the sparse map
+	// if the rest of the array is still mostly dead
+	void shrink() {
+		size_t top = slots.size();
+		while (top > 0 and not present(top-1)) {
+			top--;
+		}
+		slots.resize(top);
+		if (slots.size() > 2*length + slack) {
+			makeSparse();
+		} else {
+			slots.shrink_to_fit();
+		}
+	}
+
+	// Whether every entry of the sparse map may be stored densely, and
+	// enough has happened since they left the array to pay for moving them
+	// back
+	bool fitsDense() const {
+		if (churn < length) {
+			return false;
+		}
+		if (sparse.empty()) {
+			return true;
+		}
+		if constexpr (std::is_signed<T>::value) {
+			if (sparse.begin()->first < 0) {
+				return false;
+			}
+		}
+		size_t top = (size_t)sparse.rbegin()->first;
+		return top < (size_t)std::numeric_limits<T>::max() and top < 2*length + slack;
+	}
+
+	// Move every entry back into the array
+	void makeDense() {
+		size_t size = sparse.empty() ? 0 : (size_t)sparse.rbegin()->first + 1;
+		slots.reserve(size);
+		for (size_t i = 0; i < size; i++) {
+			slots.push_back(value_type(T(i+1), V()));
+		}
+		for (auto &entry : sparse) {
+			slots[(size_t)entry.first] = entry.second;
+		}
+		sparse.clear();
+		dense = true;
+	}
+
+	bool isDense() const {
+		return dense;
+	}
+
+	iterator find(T key) {
+		if (dense) {
+			return inRange(key) and present((size_t)key) ? iterator(this, (size_t)key) : end();
+		}
+		return iterator(this, sparse.find(key));
+	}
+
+	const_iterator find(T key) const {
+		if (dense) {
+			return inRange(key) and present((size_t)key) ? const_iterator(this, (size_t)key) : end();
+		}
+		return const_iterator(this, sparse.find(key));
+	}
+
+	size_type count(T key) const {
+		return find(key) != end() ? 1 : 0;
+	}
+
+	V &at(T key) {
+		auto pos = find(key);
+		if (pos == end()) throw std::out_of_range("DenseMap::at() missing key");
+		return pos->second;
+	}
+
+	const V &at(T key) const {
+		auto pos = find(key);
+		if (pos == end()) throw std::out_of_range("DenseMap::at() missing key");
+		return pos->second;
+	}
+
+	// The first entry whose key is at least key, or past key if upper is set
+	template <typename Self>
+	static auto bound(Self &self, T key, bool upper) -> decltype(self.begin()) {
+		using result_type = decltype(self.begin());
+		if (not self.dense) {
+			return result_type(&self, upper ? self.sparse.upper_bound(key) : self.sparse.lower_bound(key));
+		}
+		if constexpr (std::is_signed<T>::value) {
+			if (key < 0) {
+				return self.begin();
+			}
+		}
+		if ((size_t)key >= self.slots.size()) {
+			return self.end();
+		}
+		result_type result(&self, (size_t)key + (size_t)upper);
+		result.skip();
+		return result;
+	}
+
+	iterator lower_bound(T key) {
+		return bound(*this, key, false);
+	}
+
+	const_iterator lower_bound(T key) const {
+		return bound(*this, key, false);
+	}
+
+	iterator upper_bound(T key) {
+		return bound(*this, key, true);
+	}
+
+	const_iterator upper_bound(T key) const {
+		return bound(*this, key, true);
+	}
+
+	std::pair<iterator, bool> insert(const value_type &value) {
+		if (dense and not cover(value.first)) {
+			makeSparse();
+		}
+
+		if (dense) {
+			size_t i = (size_t)value.first;
+			if (present(i)) {
+				return {iterator(this, i), false};
+			}
+			slots[i] = value;
+			length++;
+			return {iterator(this, i), true};
+		}
+
+		auto result = sparse.insert({value.first, value});
+		length += (size_t)result.second;
+		churn += (size_t)result.second;
+		if (result.second and fitsDense()) {
+			makeDense();
+			return {iterator(this, (size_t)value.first), true};
+		}
+		return {iterator(this, result.first), result.second};
+	}
+
+	template <typename... Args>
+	std::pair<iterator, bool> emplace(Args&&... args) {
+		return insert(value_type(std::forward<Args>(args)...));
+	}
+
+	V &operator[](T key) {
+		auto pos = find(key);
+		if (pos == end()) {
+			pos = insert(value_type(key, V())).first;
+		}
+		return pos->second;
+	}
+
+	// Erase the entry at pos and return an iterator to the one after it
+	iterator erase(iterator pos) {
+		length--;
+		if (dense) {
+			size_t next = pos.index+1;
+			slots[pos.index] = value_type(T(pos.index+1), V());
+			if (slots.size() > 4*length + slack) {
+				shrink();
+				if (not dense) {
+					return iterator(this, sparse.lower_bound(T(next)));
+				}
+			}
+			iterator result(this, std::min(next, slots.size()));
+			result.skip();
+			return result;
+		}
+		churn++;
+		auto next = sparse.erase(pos.pos);
+		if (not fitsDense()) {
+			return iterator(this, next);
+		}
+
+		bool last = next == sparse.end();
+		T key = last ? T() : next->first;
+		makeDense();
+		return last ? end() : iterator(this, (size_t)key);
+	}
+
+	size_type erase(T key) {
+		auto pos = find(key);
+		if (pos == end()) {
+			return 0;
+		}
+		erase(pos);
+		return 1;
+	}
+
+	size_type size() const {
+		return length;
+	}
+
+	bool empty() const {
+		return length == 0;
+	}
+
+	void clear() {
+		slots.clear();
+		sparse.clear();
+		length = 0;
+		dense = true;
+		churn = 0;
+	}
+
+	iterator begin() {
+		if (dense) {
+			iterator result(this, 0);
+			result.skip();
+			return result;
+		}
+		return iterator(this, sparse.begin());
+	}
+
+	iterator end() {
+		return dense ? iterator(this, slots.size()) : iterator(this, sparse.end());
+	}
+
+	const_iterator begin() const {
+		if (dense) {
+			const_iterator result(this, 0);
+			result.skip();
+			return result;
+		}
+		return const_iterator(this, sparse.begin());
+	}
+
+	const_iterator end() const {
+		return dense ? const_iterator(this, slots.size()) : const_iterator(this, sparse.end());
+	}
+
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+};
@@ -6,119 +6,213 @@
  */
 
 #include "hash.h"
+#include "message.h"
 
-hasher::hasher()
-{
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
 
-}
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define HASH_AVX2 1
+#endif
 
-hasher::~hasher()
+static const uint64_t prime1 = hasher::prime1;
+static const uint64_t prime2 = hasher::prime2;
+static const uint64_t prime3 = hasher::prime3;
+static const uint64_t prime4 = hasher::prime4;
+static const uint64_t prime5 = hasher::prime5;
+
+// Fold in the last partial word and the total length, then avalanche
+static inline uint64_t finish64(uint64_t state, uint64_t length, const char *tail, int tail_size)
 {
+	uint64_t hash = state + length;
+
+	if (tail_size > 0)
+	{
+		uint64_t word = 0;
+		memcpy(&word, tail, tail_size);
+		hash ^= word * prime5;
+		hash = hasher::rotl64(hash, 11) * prime1;
+	}
 
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime3;
+	hash ^= hash >> 32;
+	return hash;
 }
 
-void hasher::put(const char *value, int n)
+hasher::hasher()
 {
-	data.reserve(data.size() + sizeof(char)*n);
-	for (int i = 0; i < (int)sizeof(char)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	reset();
 }
 
-void hasher::put(const unsigned char *value, int n)
+hasher::~hasher()
 {
-	data.reserve(data.size() + sizeof(unsigned char)*n);
-	for (int i = 0; i < (int)sizeof(unsigned char)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+
 }
 
-void hasher::put(const short *value, int n)
+void hasher::reset()
 {
-	data.reserve(data.size() + sizeof(short)*n);
-	for (int i = 0; i < (int)sizeof(short)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	state = prime5;
+	length = 0;
+	tail_size = 0;
 }
 
-void hasher::put(const unsigned short *value, int n)
+uint32_t hasher::get()
 {
-	data.reserve(data.size() + sizeof(unsigned short)*n);
-	for (int i = 0; i < (int)sizeof(unsigned short)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	uint64_t hash = get64();
+	return (uint32_t)(hash ^ (hash >> 32));
 }
 
-void hasher::put(const int *value, int n)
+uint64_t hasher::get64()
 {
-	data.reserve(data.size() + sizeof(int)*n);
-	for (int i = 0; i < (int)sizeof(int)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	uint64_t hash = finish64(state, length, tail, tail_size);
+	reset();
+	return hash;
 }
 
-void hasher::put(const unsigned int *value, int n)
+static void hash_batch_scalar(const char *keys, size_t size, size_t stride, size_t n, uint64_t *out)
 {
-	data.reserve(data.size() + sizeof(unsigned int)*n);
-	for (int i = 0; i < (int)sizeof(unsigned int)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	for (size_t i = 0; i < n; i++, keys += stride)
+	{
+		const char *ptr = keys;
+		uint64_t state = prime5;
+		size_t len = size;
+		for (; len >= 8; len -= 8, ptr += 8)
+		{
+			uint64_t word;
+			memcpy(&word, ptr, 8);
+			state = hasher::mix64(state, word);
+		}
+		out[i] = finish64(state, size, ptr, (int)len);
+	}
 }
 
-void hasher::put(const long *value, int n)
+#ifdef HASH_AVX2
+// AVX2 has no 64-bit multiply, so build one out of 32-bit multiplies
+__attribute__((target("avx2")))
+static inline __m256i mul64_avx2(__m256i a, __m256i b)
 {
-	data.reserve(data.size() + sizeof(long)*n);
-	for (int i = 0; i < (int)sizeof(long)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	__m256i lo = _mm256_mul_epu32(a, b);
+	__m256i cross0 = _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32));
+	__m256i cross1 = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+	return _mm256_add_epi64(lo, _mm256_slli_epi64(_mm256_add_epi64(cross0, cross1), 32));
 }
 
-void hasher::put(const unsigned long *value, int n)
+__attribute__((target("avx2")))
+static inline __m256i rotl64_avx2(__m256i x, int r)
 {
-	data.reserve(data.size() + sizeof(unsigned long)*n);
-	for (int i = 0; i < (int)sizeof(unsigned long)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	return _mm256_or_si256(_mm256_slli_epi64(x, r), _mm256_srli_epi64(x, 64-r));
 }
 
-void hasher::put(const long long *value, int n)
+// Load the last size bytes of a key, zero extended, with a fixed size copy
+static inline uint64_t load_partial(const char *ptr, size_t size)
 {
-	data.reserve(data.size() + sizeof(long long)*n);
-	for (int i = 0; i < (int)sizeof(long long)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	uint64_t word = 0;
+	switch (size)
+	{
+		case 7: memcpy(&word, ptr, 7); break;
+		case 6: memcpy(&word, ptr, 6); break;
+		case 5: memcpy(&word, ptr, 5); break;
+		case 4: memcpy(&word, ptr, 4); break;
+		case 3: memcpy(&word, ptr, 3); break;
+		case 2: memcpy(&word, ptr, 2); break;
+		case 1: memcpy(&word, ptr, 1); break;
+	}
+	return word;
 }
 
-void hasher::put(const unsigned long long *value, int n)
+static inline uint64_t load_word(const char *ptr)
 {
-	data.reserve(data.size() + sizeof(unsigned long long)*n);
-	for (int i = 0; i < (int)sizeof(unsigned long long)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	uint64_t word;
+	memcpy(&word, ptr, 8);
+	return word;
 }
 
-void hasher::put(string value)
+// Load the word at offset from each of four keys into one vector
+__attribute__((target("avx2")))
+static inline __m256i load4_avx2(const char *keys, size_t stride, size_t offset)
 {
-	data.reserve(data.size() + value.size());
-	for (int i = 0; i < (int)value.size(); i++)
-		data.push_back(value[i]);
+	return _mm256_set_epi64x(
+		(long long)load_word(keys + 3*stride + offset),
+		(long long)load_word(keys + 2*stride + offset),
+		(long long)load_word(keys + stride + offset),
+		(long long)load_word(keys + offset));
 }
 
-void hasher::put(const bool *value, int n)
+__attribute__((target("avx2")))
+static inline __m256i load4_partial_avx2(const char *keys, size_t stride, size_t offset, size_t size)
 {
-	data.reserve(data.size() + sizeof(bool)*n);
-	for (int i = 0; i < (int)sizeof(bool)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	return _mm256_set_epi64x(
+		(long long)load_partial(keys + 3*stride + offset, size),
+		(long long)load_partial(keys + 2*stride + offset, size),
+		(long long)load_partial(keys + stride + offset, size),
+		(long long)load_partial(keys + offset, size));
 }
 
-void hasher::put(const float *value, int n)
+// Hash four keys at a time, one per 64-bit lane. Each lane follows exactly
+// the same steps as hash_batch_scalar.
+__attribute__((target("avx2")))
+static void hash_batch_avx2(const char *keys, size_t size, size_t stride, size_t n, uint64_t *out)
 {
-	data.reserve(data.size() + sizeof(float)*n);
-	for (int i = 0; i < (int)sizeof(float)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+	const __m256i p1 = _mm256_set1_epi64x((long long)prime1);
+	const __m256i p2 = _mm256_set1_epi64x((long long)prime2);
+	const __m256i p3 = _mm256_set1_epi64x((long long)prime3);
+	const __m256i p4 = _mm256_set1_epi64x((long long)prime4);
+	const __m256i p5 = _mm256_set1_epi64x((long long)prime5);
+	const __m256i len = _mm256_set1_epi64x((long long)size);
+
+	size_t i = 0;
+	for (; i+4 <= n; i += 4, keys += 4*stride)
+	{
+		__m256i state = p5;
+		size_t offset = 0;
+		for (; offset+8 <= size; offset += 8)
+		{
+			__m256i word = load4_avx2(keys, stride, offset);
+			state = _mm256_xor_si256(state, mul64_avx2(rotl64_avx2(mul64_avx2(word, p2), 31), p1));
+			state = _mm256_add_epi64(mul64_avx2(rotl64_avx2(state, 27), p1), p4);
+		}
+
+		__m256i hash = _mm256_add_epi64(state, len);
+		if (offset < size)
+		{
+			__m256i word = load4_partial_avx2(keys, stride, offset, size-offset);
+			hash = _mm256_xor_si256(hash, mul64_avx2(word, p5));
+			hash = mul64_avx2(rotl64_avx2(hash, 11), p1);
+		}
+
+		hash = _mm256_xor_si256(hash, _mm256_srli_epi64(hash, 33));
+		hash = mul64_avx2(hash, p2);
+		hash = _mm256_xor_si256(hash, _mm256_srli_epi64(hash, 29));
+		hash = mul64_avx2(hash, p3);
+		hash = _mm256_xor_si256(hash, _mm256_srli_epi64(hash, 32));
+		_mm256_storeu_si256((__m256i*)(out+i), hash);
+	}
+
+	hash_batch_scalar(keys, size, stride, n-i, out+i);
 }
+#endif
 
-void hasher::put(const double *value, int n)
+void hash_batch_bytes(const void *keys, size_t size, size_t stride, size_t n, uint64_t *out)
 {
-	data.reserve(data.size() + sizeof(double)*n);
-	for (int i = 0; i < (int)sizeof(double)*n; i++)
-		data.push_back(*(((const char *)value) + i));
+#ifdef HASH_AVX2
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	if (has_avx2)
+	{
+		hash_batch_avx2((const char *)keys, size, stride, n, out);
+		return;
+	}
+#endif
+	hash_batch_scalar((const char *)keys, size, stride, n, out);
 }
 
-uint32_t hasher::get()
+uint32_t superfasthash(const char *ptr, uint32_t len)
 {
-	uint32_t len = data.size();
-	const char* ptr = data.data();
 	uint32_t hash = len, tmp;
 	int rem;
 
@@ -162,6 +256,310 @@ uint32_t hasher::get()
 	hash ^= hash << 25;
 	hash += hash >> 6;
 
-	data.clear();
 	return hash;
 }
+
+hash_stats::hash_stats()
+{
+	size = 0;
+	capacity = 0;
+	bytes = 0;
+	chained = false;
+	lookups = 0;
+	probes = 0;
+	max_probe = 0;
+	rehashes = 0;
+}
+
+hash_stats::~hash_stats()
+{
+}
+
+// Count one bucket of the given size, or one entry the given distance
+// from its home.
+void hash_stats::add(size_t bucket)
+{
+	if (bucket >= histogram.size())
+		histogram.resize(bucket+1, 0);
+	histogram[bucket]++;
+}
+
+float hash_stats::load_factor() const
+{
+	return capacity == 0 ? 0.0f : (float)size/(float)capacity;
+}
+
+float hash_stats::average_probe() const
+{
+	if (lookups > 0)
+		return (float)probes/(float)lookups;
+
+	if (size == 0)
+		return 0.0f;
+
+	// A successful lookup searches a bucket of i entries halfway on
+	// average, or visits i+1 slots to reach an entry i slots from home.
+	double total = 0.0;
+	for (size_t i = 0; i < histogram.size(); i++)
+	{
+		if (chained)
+			total += (double)histogram[i]*(double)i*(double)(i+1)/2.0;
+		else
+			total += (double)histogram[i]*(double)(i+1);
+	}
+	return (float)(total/(double)size);
+}
+
+void hash_stats::dump(string location) const
+{
+	log(location, "size " + to_string(size) + ", capacity " + to_string(capacity)
+		+ ", load factor " + to_string(load_factor()) + ", " + to_string(bytes) + " bytes", __FILE__, __LINE__);
+
+	string line = chained ? "bucket sizes" : "probe distances";
+	for (size_t i = 0; i < histogram.size(); i++)
+		if (histogram[i] != 0)
+			line += " " + to_string(i) + ":" + to_string(histogram[i]);
+	log(location, line, __FILE__, __LINE__);
+
+	// The counters are zero unless the table was compiled with HASH_STATS
+	if (lookups > 0 || rehashes > 0)
+		log(location, to_string(lookups) + " lookups, average probe " + to_string(average_probe())
+			+ ", max probe " + to_string(max_probe) + ", " + to_string(rehashes) + " rehashes", __FILE__, __LINE__);
+	else
+		log(location, "expected probe " + to_string(average_probe()), __FILE__, __LINE__);
+}
+
+static const char perfect_hash_magic[8] = {'P', 'E', 'R', 'F', 'H', 'A', 'S', 'H'};
+static const uint32_t perfect_hash_version = 1;
+
+// Give every level its own independent hash of the key's digest. Level 0
+// uses the digest as is.
+static inline uint64_t level_hash(uint64_t hash, int level)
+{
+	if (level == 0)
+		return hash;
+
+	uint64_t x = hash ^ ((uint64_t)level*prime2);
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDULL;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+// Map x onto [0, n) without a divide
+static inline uint64_t fastrange64(uint64_t x, uint64_t n)
+{
+	return (uint64_t)(((unsigned __int128)x*n) >> 64);
+}
+
+perfect_hash::perfect_hash(double gamma)
+{
+	this->gamma = gamma;
+	count = 0;
+}
+
+perfect_hash::~perfect_hash()
+{
+}
+
+void perfect_hash::build(const uint64_t *hashes, size_t n)
+{
+	clear();
+
+	vector<uint64_t> keys(hashes, hashes+n);
+	sort(keys.begin(), keys.end());
+	keys.resize(unique(keys.begin(), keys.end()) - keys.begin());
+	count = keys.size();
+
+	offsets.push_back(0);
+	vector<uint64_t> seen;
+	vector<uint64_t> collide;
+	for (int level = 0; level < max_levels && !keys.empty(); level++)
+	{
+		size_t words = (size_t)ceil(gamma*(double)keys.size()/64.0);
+		if (words < 1)
+			words = 1;
+		uint64_t level_bits = (uint64_t)words*64;
+
+		seen.assign(words, 0);
+		collide.assign(words, 0);
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			uint64_t pos = fastrange64(level_hash(keys[i], level), level_bits);
+			uint64_t bit = (uint64_t)1 << (pos & 63);
+			if (seen[pos >> 6] & bit)
+				collide[pos >> 6] |= bit;
+			else
+				seen[pos >> 6] |= bit;
+		}
+
+		// Keys that shared a position move on to the next level
+		size_t remaining = 0;
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			uint64_t pos = fastrange64(level_hash(keys[i], level), level_bits);
+			if (collide[pos >> 6] & ((uint64_t)1 << (pos & 63)))
+				keys[remaining++] = keys[i];
+		}
+		keys.resize(remaining);
+
+		for (size_t i = 0; i < words; i++)
+			bits.push_back(seen[i] & ~collide[i]);
+		offsets.push_back(bits.size());
+	}
+
+	ranks.resize((bits.size() + rank_block-1)/rank_block);
+	uint32_t total = 0;
+	for (size_t i = 0; i < bits.size(); i++)
+	{
+		if (i%rank_block == 0)
+			ranks[i/rank_block] = total;
+		total += __builtin_popcountll(bits[i]);
+	}
+
+	for (size_t i = 0; i < keys.size(); i++)
+		fallback.insert(keys[i], total + (uint32_t)i);
+}
+
+size_t perfect_hash::find_hash(uint64_t hash) const
+{
+	for (int level = 0; level+1 < (int)offsets.size(); level++)
+	{
+		uint64_t level_bits = (offsets[level+1] - offsets[level])*64;
+		uint64_t pos = offsets[level]*64 + fastrange64(level_hash(hash, level), level_bits);
+		size_t word = pos >> 6;
+		uint64_t bit = (uint64_t)1 << (pos & 63);
+		if (bits[word] & bit)
+		{
+			size_t result = ranks[word/rank_block];
+			for (size_t i = word - word%rank_block; i < word; i++)
+				result += __builtin_popcountll(bits[i]);
+			return result + __builtin_popcountll(bits[word] & (bit-1));
+		}
+	}
+
+	flat_hashmap<uint64_t, uint32_t>::const_iterator loc;
+	if (fallback.find(hash, &loc))
+		return loc->second;
+	return npos;
+}
+
+size_t perfect_hash::size() const
+{
+	return count;
+}
+
+size_t perfect_hash::bytes() const
+{
+	return bits.size()*sizeof(uint64_t) + offsets.size()*sizeof(uint64_t)
+		+ ranks.size()*sizeof(uint32_t) + fallback.stats().bytes;
+}
+
+void perfect_hash::clear()
+{
+	count = 0;
+	bits.clear();
+	offsets.clear();
+	ranks.clear();
+	fallback.clear();
+}
+
+// The file holds the magic and version, then count, gamma, and the
+// offsets, bits, ranks, and fallback entries, each preceded by its length.
+bool perfect_hash::save(string path) const
+{
+	FILE *fptr = fopen(path.c_str(), "wb");
+	if (fptr == NULL)
+	{
+		error(path, "unable to open perfect hash for writing", __FILE__, __LINE__);
+		return false;
+	}
+
+	vector<pair<uint64_t, uint64_t> > extra;
+	for (flat_hashmap<uint64_t, uint32_t>::const_iterator i = fallback.begin(); i != fallback.end(); i++)
+		extra.push_back(pair<uint64_t, uint64_t>(i->first, i->second));
+
+	uint64_t header[6] = {count, offsets.size(), bits.size(), ranks.size(), extra.size(), 0};
+	memcpy(&header[5], &gamma, sizeof(double));
+
+	// An empty section has no data pointer to pass to fwrite
+	bool success = fwrite(perfect_hash_magic, 1, 8, fptr) == 8
+		&& fwrite(&perfect_hash_version, sizeof(uint32_t), 1, fptr) == 1
+		&& fwrite(header, sizeof(uint64_t), 6, fptr) == 6
+		&& (offsets.empty() || fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), fptr) == offsets.size())
+		&& (bits.empty() || fwrite(bits.data(), sizeof(uint64_t), bits.size(), fptr) == bits.size())
+		&& (ranks.empty() || fwrite(ranks.data(), sizeof(uint32_t), ranks.size(), fptr) == ranks.size())
+		&& (extra.empty() || fwrite(extra.data(), sizeof(pair<uint64_t, uint64_t>), extra.size(), fptr) == extra.size());
+	success = fclose(fptr) == 0 && success;
+	if (!success)
+		error(path, "unable to write perfect hash", __FILE__, __LINE__);
+	return success;
+}
+
+bool perfect_hash::load(string path)
+{
+	clear();
+
+	FILE *fptr = fopen(path.c_str(), "rb");
+	if (fptr == NULL)
+	{
+		error(path, "unable to open perfect hash", __FILE__, __LINE__);
+		return false;
+	}
+
+	char magic[8];
+	uint32_t version = 0;
+	uint64_t header[6];
+	if (fread(magic, 1, 8, fptr) != 8 || memcmp(magic, perfect_hash_magic, 8) != 0
+		|| fread(&version, sizeof(uint32_t), 1, fptr) != 1 || version != perfect_hash_version
+		|| fread(header, sizeof(uint64_t), 6, fptr) != 6)
+	{
+		fclose(fptr);
+		error(path, "not a perfect hash", __FILE__, __LINE__);
+		return false;
+	}
+
+	// Check the section sizes against each other before trusting them
+	// with an allocation.
+	fseek(fptr, 0, SEEK_END);
+	uint64_t remaining = (uint64_t)ftell(fptr) - 8 - sizeof(uint32_t) - 6*sizeof(uint64_t);
+	fseek(fptr, 8 + sizeof(uint32_t) + 6*sizeof(uint64_t), SEEK_SET);
+	if (header[1] > remaining || header[2] > remaining || header[3] > remaining || header[4] > remaining
+		|| header[1]*sizeof(uint64_t) + header[2]*sizeof(uint64_t) + header[3]*sizeof(uint32_t)
+		+ header[4]*sizeof(pair<uint64_t, uint64_t>) != remaining
+		|| header[3] != (header[2] + rank_block-1)/rank_block)
+	{
+		fclose(fptr);
+		error(path, "perfect hash is corrupt", __FILE__, __LINE__);
+		return false;
+	}
+
+	count = header[0];
+	memcpy(&gamma, &header[5], sizeof(double));
+	offsets.resize(header[1]);
+	bits.resize(header[2]);
+	ranks.resize(header[3]);
+	vector<pair<uint64_t, uint64_t> > extra(header[4]);
+
+	bool success = (offsets.empty() || fread(offsets.data(), sizeof(uint64_t), offsets.size(), fptr) == offsets.size())
+		&& (bits.empty() || fread(bits.data(), sizeof(uint64_t), bits.size(), fptr) == bits.size())
+		&& (ranks.empty() || fread(ranks.data(), sizeof(uint32_t), ranks.size(), fptr) == ranks.size())
+		&& (extra.empty() || fread(extra.data(), sizeof(pair<uint64_t, uint64_t>), extra.size(), fptr) == extra.size());
+	fclose(fptr);
+
+	for (size_t i = 0; success && i+1 < offsets.size(); i++)
+		success = offsets[i] < offsets[i+1];
+	success = success && (offsets.empty() || (offsets[0] == 0 && offsets.back() == bits.size()));
+	if (!success)
+	{
+		clear();
+		error(path, "perfect hash is corrupt", __FILE__, __LINE__);
+		return false;
+	}
+
+	for (size_t i = 0; i < extra.size(); i++)
+		fallback.insert(extra[i].first, (uint32_t)extra[i].second);
+	return true;
+}
@@ -3,129 +3,559 @@
 #include <vector>
 #include <list>
 #include <string>
+#include <string_view>
 #include <map>
+#include <set>
+#include <tuple>
 #include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <new>
+#include <type_traits>
 #include <sys/types.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "interface.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 using namespace std;
 
-struct hasher
+struct hasher;
+
+// hash_traits<type> tells hasher how to feed a value of that type into the
+// digest. By default it calls the type's own hash(hasher&) member. Types
+// whose bytes alone determine their value set bytes, which lets hasher
+// consume whole arrays of them with a single write. Composite types can
+// list the members to hash with HASH_MEMBERS instead of writing a hash()
+// member. Anything of variable length, strings and containers, writes its
+// length ahead of its contents, so that ("a", "bc") and ("ab", "c") or
+// {{1}, {2, 3}} and {{1, 2}, {3}} hash differently.
+template <class type, class enable = void>
+struct hash_traits
 {
-	hasher();
+	static constexpr bool bytes = false;
 
-	template <class type0, class type1>
-	hasher(const pair<type0, type1> *value)
+	static void put(hasher &h, const type &value)
 	{
-		put(value);
+		value.hash(h);
 	}
+};
+
+struct hasher
+{
+	hasher();
 
 	template <class type>
-	hasher(const type *value, int n = 1)
+	hasher(const type *value, int n = 1) : hasher()
 	{
 		put(value, n);
 	}
 
-	template <class type>
-	hasher(const vector<type> *value)
+	~hasher();
+
+	static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+	static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+	static constexpr uint64_t prime3 = 0x165667B19E3779F9ULL;
+	static constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+	static constexpr uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+	static inline uint64_t rotl64(uint64_t x, int r)
 	{
-		put(value);
+		return (x << r) | (x >> (64 - r));
 	}
 
-	template <class type>
-	hasher(const list<type> *value)
+	// Mix one 64-bit word into the running state (the xxHash64 word step)
+	static inline uint64_t mix64(uint64_t state, uint64_t word)
 	{
-		put(value);
+		state ^= rotl64(word * prime2, 31) * prime1;
+		return rotl64(state, 27) * prime1 + prime4;
 	}
 
-	template <class key_type, class value_type>
-	hasher(const map<key_type, value_type> *lst)
+	// Streaming state. Input is mixed eight bytes at a time as it arrives
+	// so no copy of the key is ever made. Bytes that do not yet fill a
+	// whole word wait in tail.
+	uint64_t state;
+	uint64_t length;
+	char tail[8];
+	int tail_size;
+
+	void reset();
+
+	void write(const void *value, size_t size)
 	{
-		put(lst);
-	}
+		// An empty range may have a null pointer, which memcpy must not see
+		if (size == 0)
+			return;
 
-	~hasher();
+		const char *ptr = (const char *)value;
+		length += size;
+
+		if (tail_size > 0)
+		{
+			size_t n = 8 - tail_size;
+			if (n > size)
+				n = size;
+			memcpy(tail + tail_size, ptr, n);
+			tail_size += n;
+			ptr += n;
+			size -= n;
+
+			if (tail_size < 8)
+				return;
+
+			uint64_t word;
+			memcpy(&word, tail, 8);
+			state = mix64(state, word);
+			tail_size = 0;
+		}
 
-	vector<char> data;
+		for (; size >= 8; size -= 8, ptr += 8)
+		{
+			uint64_t word;
+			memcpy(&word, ptr, 8);
+			state = mix64(state, word);
+		}
+
+		if (size > 0)
+		{
+			memcpy(tail, ptr, size);
+			tail_size = size;
+		}
+	}
 
 	template <class type>
 	void put(const type *value, int n = 1)
 	{
-		for (int i = 0; i < n; i++)
+		if constexpr (hash_traits<type>::bytes)
+			write(value, sizeof(type)*n);
+		else
 		{
-			value->hash(*this);
-			value++;
+			for (int i = 0; i < n; i++)
+				hash_traits<type>::put(*this, value[i]);
 		}
 	}
 
-	void put(const char *value, int n = 1);
-	void put(const unsigned char *value, int n = 1);
-	void put(const short *value, int n = 1);
-	void put(const unsigned short *value, int n = 1);
-	void put(const int *value, int n = 1);
-	void put(const unsigned int *value, int n = 1);
-	void put(const long *value, int n = 1);
-	void put(const unsigned long *value, int n = 1);
-	void put(const long long *value, int n = 1);
-	void put(const unsigned long long *value, int n = 1);
-	void put(string value);
-	void put(const bool *value, int n = 1);
-	void put(const float *value, int n = 1);
-	void put(const double *value, int n = 1);
+	// Write the length of a variable length value ahead of its contents
+	void put_length(size_t n)
+	{
+		uint64_t length = n;
+		write(&length, sizeof(length));
+	}
+
+	void put(const string &value)
+	{
+		put_length(value.size());
+		write(value.data(), value.size());
+	}
 
-	template <class type0, class type1>
-	void put(const pair<type0, type1> *value)
+	void put(string_view value)
 	{
-		put(&value->first);
-		put(&value->second);
+		put_length(value.size());
+		write(value.data(), value.size());
 	}
 
-	template <class type>
-	void put(const vector<type> *lst)
+	// get() and get64() return the digest of everything put so far and
+	// reset the hasher for the next key. get() folds the 64-bit digest
+	// down to 32 bits.
+	uint32_t get();
+	uint64_t get64();
+};
+
+template <class type>
+struct hash_traits<type, typename enable_if<is_arithmetic<type>::value || is_enum<type>::value>::type>
+{
+	static constexpr bool bytes = true;
+
+	static void put(hasher &h, const type &value)
 	{
-		put(lst->data(), (int)lst->size());
+		h.write(&value, sizeof(type));
 	}
+};
 
-	template <class type>
-	void put(const list<type> *lst)
+template <class type, size_t n>
+struct hash_traits<array<type, n> >
+{
+	static constexpr bool bytes = hash_traits<type>::bytes;
+
+	static void put(hasher &h, const array<type, n> &value)
+	{
+		h.put(value.data(), (int)n);
+	}
+};
+
+template <class type>
+struct hash_traits<vector<type> >
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const vector<type> &value)
 	{
-		for (typename list<type>::iterator i = lst->begin(); i != lst->end(); i++)
-			put(&(*i));
+		h.put_length(value.size());
+		h.put(value.data(), (int)value.size());
 	}
+};
+
+template <>
+struct hash_traits<vector<bool> >
+{
+	static constexpr bool bytes = false;
 
-	template <class key_type, class value_type>
-	void put(const map<key_type, value_type> *lst)
+	static void put(hasher &h, const vector<bool> &value)
 	{
-		for (typename map<key_type, value_type>::iterator i = lst->begin(); i != lst->end(); i++)
+		h.put_length(value.size());
+		for (auto i = value.begin(); i != value.end(); i++)
 		{
-			put(&i->first);
-			put(&i->second);
+			bool bit = *i;
+			h.write(&bit, sizeof(bool));
 		}
 	}
+};
+
+template <>
+struct hash_traits<string>
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const string &value)
+	{
+		h.put(value);
+	}
+};
 
-	uint32_t get();
+template <>
+struct hash_traits<string_view>
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const string_view &value)
+	{
+		h.put(value);
+	}
+};
+
+// C strings hash as their characters, the same as the equal string. A char
+// array is read up to its first null, as for a string literal, but never
+// past its end.
+template <>
+struct hash_traits<const char*>
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const char *value)
+	{
+		h.put(string_view(value));
+	}
+};
+
+template <>
+struct hash_traits<char*> : hash_traits<const char*>
+{
+};
+
+template <size_t n>
+struct hash_traits<char[n]>
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const char (&value)[n])
+	{
+		h.put(string_view(value, strnlen(value, n)));
+	}
+};
+
+// Whether a lookup_type hashes and compares the same as an equal key_type.
+// The hash tables accept any such type in place of a key for their
+// lookups, which saves building a key just to search for it. Specialize
+// this along with hash_traits to search by a lightweight view of a key.
+template <class key_type, class lookup_type>
+struct hash_transparent
+{
+	static const bool value = is_same<key_type, lookup_type>::value;
+};
+
+template <class lookup_type>
+struct hash_transparent<string, lookup_type>
+{
+	static const bool value = is_convertible<const lookup_type&, string_view>::value;
+};
+
+template <class lookup_type>
+struct hash_transparent<string_view, lookup_type>
+{
+	static const bool value = is_convertible<const lookup_type&, string_view>::value;
+};
+
+// Enable a heterogeneous overload for lookup types other than the key
+// itself, which keeps its own non-template overload.
+template <class key_type, class lookup_type>
+using enable_lookup = typename enable_if<!is_same<key_type, lookup_type>::value && hash_transparent<key_type, lookup_type>::value, int>::type;
+
+template <class type0, class type1>
+struct hash_traits<pair<type0, type1> >
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const pair<type0, type1> &value)
+	{
+		h.put(&value.first);
+		h.put(&value.second);
+	}
+};
+
+template <class... types>
+struct hash_traits<tuple<types...> >
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const tuple<types...> &value)
+	{
+		apply([&h](const types &... elems) { (h.put(&elems), ...); }, value);
+	}
+};
+
+template <class type>
+struct hash_traits<list<type> >
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const list<type> &value)
+	{
+		h.put_length(value.size());
+		for (auto i = value.begin(); i != value.end(); i++)
+			h.put(&*i);
+	}
+};
+
+template <class type>
+struct hash_traits<set<type> >
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const set<type> &value)
+	{
+		h.put_length(value.size());
+		for (auto i = value.begin(); i != value.end(); i++)
+			h.put(&*i);
+	}
+};
+
+template <class key_type, class value_type>
+struct hash_traits<map<key_type, value_type> >
+{
+	static constexpr bool bytes = false;
+
+	static void put(hasher &h, const map<key_type, value_type> &value)
+	{
+		h.put_length(value.size());
+		for (auto i = value.begin(); i != value.end(); i++)
+		{
+			h.put(&i->first);
+			h.put(&i->second);
+		}
+	}
+};
+
+// Generate hash_traits for a composite type from a list of its members,
+// which are hashed in order. This must be used at global scope.
+//
+// HASH_MEMBERS(ucs::Net, fields, region)
+#define HASH_MEMBER(member) h.put(&value.member);
+#define HASH_MEMBERS(type, ...) \
+	template <> \
+	struct hash_traits<type> \
+	{ \
+		static constexpr bool bytes = false; \
+		static void put(hasher &h, const type &value) \
+		{ \
+			FOR_EACH(HASH_MEMBER, __VA_ARGS__) \
+		} \
+	};
+
+// The original SuperFastHash over a flat buffer, kept for comparison
+// against the streaming hasher.
+uint32_t superfasthash(const char *ptr, uint32_t len);
+
+// Hash n keys of size bytes each, stride bytes apart, as if each had been
+// passed to its own hasher. The keys are hashed four at a time with AVX2
+// when the processor supports it.
+void hash_batch_bytes(const void *keys, size_t size, size_t stride, size_t n, uint64_t *out);
+
+// Whether every byte of a type is part of its value, so that hashing its
+// raw bytes is deterministic. Padding bytes may hold anything. Floating
+// point types count, since hasher hashes their bytes as well.
+template <class type>
+struct hash_unpadded : integral_constant<bool, has_unique_object_representations<type>::value || is_floating_point<type>::value>
+{
+};
+
+template <class type, size_t n>
+struct hash_unpadded<array<type, n> > : hash_unpadded<type>
+{
+};
+
+// Hash a contiguous array of trivially copyable keys. For types that
+// hash_traits marks as bytes this gives the same digests as hasher.
+template <class type>
+void hash_batch(const type *keys, size_t n, uint64_t *out)
+{
+	static_assert(is_trivially_copyable<type>::value, "hash_batch requires trivially copyable keys");
+	static_assert(hash_unpadded<type>::value, "hash_batch requires keys without padding bytes");
+	hash_batch_bytes(keys, sizeof(type), sizeof(type), n, out);
+}
+
+// Lookup counters for the hash tables. Lookups are const and
+// concurrent_hashmap runs them under a shared lock, so every counter is a
+// relaxed atomic.
+struct hash_probe_counters
+{
+	hash_probe_counters()
+	{
+		reset();
+	}
+
+	hash_probe_counters(const hash_probe_counters &copy)
+	{
+		*this = copy;
+	}
+
+	mutable atomic<uint64_t> lookups;
+	mutable atomic<uint64_t> probes;
+	mutable atomic<uint64_t> max_probe;
+	atomic<uint64_t> rehashes;
+
+	hash_probe_counters &operator=(const hash_probe_counters &copy)
+	{
+		lookups.store(copy.lookups.load(memory_order_relaxed), memory_order_relaxed);
+		probes.store(copy.probes.load(memory_order_relaxed), memory_order_relaxed);
+		max_probe.store(copy.max_probe.load(memory_order_relaxed), memory_order_relaxed);
+		rehashes.store(copy.rehashes.load(memory_order_relaxed), memory_order_relaxed);
+		return *this;
+	}
+
+	void lookup(uint64_t length) const
+	{
+		lookups.fetch_add(1, memory_order_relaxed);
+		probes.fetch_add(length, memory_order_relaxed);
+		uint64_t longest = max_probe.load(memory_order_relaxed);
+		while (length > longest && !max_probe.compare_exchange_weak(longest, length, memory_order_relaxed));
+	}
+
+	void rehash()
+	{
+		rehashes.fetch_add(1, memory_order_relaxed);
+	}
+
+	void reset()
+	{
+		lookups.store(0, memory_order_relaxed);
+		probes.store(0, memory_order_relaxed);
+		max_probe.store(0, memory_order_relaxed);
+		rehashes.store(0, memory_order_relaxed);
+	}
+};
+
+struct hash_no_counters
+{
+	void lookup(uint64_t) const {}
+	void rehash() {}
+	void reset() {}
+};
+
+// The tables only count when HASH_STATS is defined, otherwise every call is
+// empty and the member takes no space. Because the tables are templates,
+// HASH_STATS must be defined the same way for every file that instantiates
+// a given table.
+#ifdef HASH_STATS
+using hash_counters = hash_probe_counters;
+#else
+using hash_counters = hash_no_counters;
+#endif
+
+// A snapshot of the health of a hash table, gathered on demand by its
+// stats() function.
+struct hash_stats
+{
+	hash_stats();
+	~hash_stats();
+
+	size_t size;
+	size_t capacity;
+	// Memory held by the table itself, not counting memory owned by the
+	// keys and values.
+	size_t bytes;
+
+	// For chained tables, histogram[i] is the number of buckets holding i
+	// entries. For open addressing tables, it is the number of entries
+	// stored i slots (or groups) past their home.
+	bool chained;
+	vector<size_t> histogram;
+
+	// Counted since construction, only with HASH_STATS. A probe length is
+	// the number of slots or groups visited, or for chained tables the size
+	// of the bucket searched.
+	uint64_t lookups;
+	uint64_t probes;
+	uint64_t max_probe;
+	uint64_t rehashes;
+
+	void add(size_t bucket);
+	void count(const hash_probe_counters &counters)
+	{
+		lookups = counters.lookups.load(memory_order_relaxed);
+		probes = counters.probes.load(memory_order_relaxed);
+		max_probe = counters.max_probe.load(memory_order_relaxed);
+		rehashes = counters.rehashes.load(memory_order_relaxed);
+	}
+
+	void count(const hash_no_counters &)
+	{
+	}
+
+	float load_factor() const;
+	// The average over counted lookups if there are any, otherwise the
+	// expected length of a successful lookup given the histogram.
+	float average_probe() const;
+
+	// Report everything through log()
+	void dump(string location) const;
 };
 
 
 template <class key_type, class value_type, int num_buckets>
 struct hashmap
 {
+	hashmap()
+	{
+		count = 0;
+	}
+
 	array<map<key_type, value_type>, num_buckets> buckets;
 	int count;
+	[[no_unique_address]] hash_counters counters;
 
 	bool insert(const key_type &key, const value_type &value, typename map<key_type, value_type>::iterator* loc = NULL)
 	{
 		int bucket = hasher(&key).get()%num_buckets;
+		counters.lookup(buckets[bucket].size());
 		pair<typename map<key_type, value_type>::iterator, bool> result = buckets[bucket].insert(pair<key_type, value_type>(key, value));
 		if (loc != NULL)
 			*loc = result.first;
-		count++;
+		if (result.second)
+			count++;
 		return result.second;
 	}
 
 	bool find(const key_type &key, typename map<key_type, value_type>::iterator* loc = NULL)
 	{
 		int bucket = hasher(&key).get()%num_buckets;
+		counters.lookup(buckets[bucket].size());
 		typename map<key_type, value_type>::iterator result = buckets[bucket].find(key);
 		if (loc != NULL)
 			*loc = result;
@@ -136,6 +566,7 @@ struct hashmap
 	{
 		int bucket = hasher(&iter->first).get()%num_buckets;
 		buckets[bucket].erase(iter);
+		count--;
 	}
 
 	int max_bucket_size()
@@ -146,17 +577,37 @@ struct hashmap
 				max_size = buckets[i].size();
 		return max_size;
 	}
+
+	hash_stats stats() const
+	{
+		hash_stats result;
+		result.chained = true;
+		result.size = count;
+		result.capacity = num_buckets;
+		result.bytes = sizeof(buckets) + count*(sizeof(typename map<key_type, value_type>::value_type) + 4*sizeof(void*));
+		for (int i = 0; i < num_buckets; i++)
+			result.add(buckets[i].size());
+		result.count(counters);
+		return result;
+	}
 };
 
 template <class value_type, int num_buckets>
 struct hashtable
 {
+	hashtable()
+	{
+		count = 0;
+	}
+
 	array<vector<value_type>, num_buckets> buckets;
 	int count;
+	[[no_unique_address]] hash_counters counters;
 
 	bool insert(const value_type &value, typename vector<value_type>::iterator *loc = NULL)
 	{
 		int bucket = hasher(&value).get()%num_buckets;
+		counters.lookup(buckets[bucket].size());
 		typename vector<value_type>::iterator result = lower_bound(buckets[bucket].begin(), buckets[bucket].end(), value);
 		if (result == buckets[bucket].end() || *result != value)
 		{
@@ -176,7 +627,8 @@ struct hashtable
 
 	bool contains(const value_type &value, typename vector<value_type>::iterator *loc = NULL)
 	{
-		int bucket = hasher(value).get()%num_buckets;
+		int bucket = hasher(&value).get()%num_buckets;
+		counters.lookup(buckets[bucket].size());
 		typename vector<value_type>::iterator result = lower_bound(buckets[bucket].begin(), buckets[bucket].end(), value);
 		if (loc != NULL)
 			*loc = result;
@@ -186,9 +638,13 @@ struct hashtable
 
 	void erase(const value_type &value)
 	{
-		int bucket = hasher(value).get()%num_buckets;
+		int bucket = hasher(&value).get()%num_buckets;
 		typename vector<value_type>::iterator result = lower_bound(buckets[bucket].begin(), buckets[bucket].end(), value);
-		buckets[bucket].erase(result);
+		if (result != buckets[bucket].end() && *result == value)
+		{
+			buckets[bucket].erase(result);
+			count--;
+		}
 	}
 
 	int max_bucket_size()
@@ -199,5 +655,1294 @@ struct hashtable
 				max_size = buckets[i].size();
 		return max_size;
 	}
+
+	hash_stats stats() const
+	{
+		hash_stats result;
+		result.chained = true;
+		result.size = count;
+		result.capacity = num_buckets;
+		result.bytes = sizeof(buckets);
+		for (int i = 0; i < num_buckets; i++)
+		{
+			result.bytes += buckets[i].capacity()*sizeof(value_type);
+			result.add(buckets[i].size());
+		}
+		result.count(counters);
+		return result;
+	}
 };
 
+// flat_hashmap is an open addressing replacement for hashmap. Entries live
+// in a single contiguous array and collisions are resolved by Robin Hood
+// linear probing, so a lookup only touches a few neighboring slots. Erase
+// shifts the following entries back rather than leaving tombstones, and the
+// table doubles whenever an insert would push it past max_load. Both the key
+// and value types must be default constructible.
+template <class key_type, class value_type>
+struct flat_hashmap
+{
+	typedef pair<key_type, value_type> entry;
+
+	flat_hashmap()
+	{
+		count = 0;
+		max_load = 0.875f;
+	}
+
+	// dist[i] is one more than the distance of slot i from the home slot of
+	// the entry stored there, or zero if the slot is empty.
+	vector<entry> slots;
+	vector<uint8_t> dist;
+	size_t count;
+	float max_load;
+	[[no_unique_address]] hash_counters counters;
+
+	static const size_t npos = (size_t)-1;
+
+	struct iterator
+	{
+		iterator() : parent(NULL), index(0) {}
+		iterator(flat_hashmap *parent, size_t index) : parent(parent), index(index)
+		{
+			skip();
+		}
+
+		flat_hashmap *parent;
+		size_t index;
+
+		void skip()
+		{
+			while (index < parent->dist.size() && parent->dist[index] == 0)
+				index++;
+		}
+
+		entry &operator*() const { return parent->slots[index]; }
+		entry *operator->() const { return &parent->slots[index]; }
+		iterator &operator++() { index++; skip(); return *this; }
+		iterator operator++(int) { iterator tmp = *this; ++(*this); return tmp; }
+		bool operator==(const iterator &other) const { return index == other.index; }
+		bool operator!=(const iterator &other) const { return index != other.index; }
+	};
+
+	struct const_iterator
+	{
+		const_iterator() : parent(NULL), index(0) {}
+		const_iterator(const flat_hashmap *parent, size_t index) : parent(parent), index(index)
+		{
+			skip();
+		}
+
+		const flat_hashmap *parent;
+		size_t index;
+
+		void skip()
+		{
+			while (index < parent->dist.size() && parent->dist[index] == 0)
+				index++;
+		}
+
+		const entry &operator*() const { return parent->slots[index]; }
+		const entry *operator->() const { return &parent->slots[index]; }
+		const_iterator &operator++() { index++; skip(); return *this; }
+		const_iterator operator++(int) { const_iterator tmp = *this; ++(*this); return tmp; }
+		bool operator==(const const_iterator &other) const { return index == other.index; }
+		bool operator!=(const const_iterator &other) const { return index != other.index; }
+	};
+
+	template <class lookup_type>
+	static uint64_t hash_of(const lookup_type &key)
+	{
+		return hasher(&key).get64();
+	}
+
+	// Hash the keys of n consecutive entries
+	static void hash_all(const entry *entries, size_t n, uint64_t *out)
+	{
+		if constexpr (hash_traits<key_type>::bytes)
+		{
+			static_assert(hash_unpadded<key_type>::value, "a key hashed as bytes must have no padding bytes");
+			if (n > 0)
+				hash_batch_bytes(&entries->first, sizeof(key_type), sizeof(entry), n, out);
+		}
+		else
+		{
+			for (size_t i = 0; i < n; i++)
+				out[i] = hash_of(entries[i].first);
+		}
+	}
+
+	// Look for key given its precomputed hash. On success, index is set to
+	// the slot holding it. key may be any type that is hash_transparent with
+	// key_type.
+	template <class lookup_type>
+	bool find_slot(const lookup_type &key, uint64_t hash, size_t &index) const
+	{
+		if (count == 0)
+			return false;
+
+		size_t mask = slots.size()-1;
+		size_t i = hash & mask;
+		int d = 1;
+		for (; dist[i] >= d; d++)
+		{
+			if (slots[i].first == key)
+			{
+				counters.lookup(d);
+				index = i;
+				return true;
+			}
+			i = (i+1) & mask;
+		}
+		counters.lookup(d);
+		return false;
+	}
+
+	// Place an entry known not to be in the table and return its slot.
+	size_t insert_slot(entry value, uint64_t hash)
+	{
+		if (count+1 > (size_t)(slots.size()*max_load))
+			rehash(slots.empty() ? 16 : slots.size()*2);
+
+		size_t mask = slots.size()-1;
+		size_t i = hash & mask;
+		size_t result = npos;
+		uint8_t d = 1;
+		while (dist[i] != 0)
+		{
+			// Robin Hood: steal the slot from any entry that is closer to
+			// its home than we are to ours, and carry that entry forward.
+			if (dist[i] < d)
+			{
+				std::swap(slots[i], value);
+				std::swap(dist[i], d);
+				if (result == npos)
+					result = i;
+			}
+
+			i = (i+1) & mask;
+			if (++d == 255)
+			{
+				// The probe distance no longer fits in a byte. Grow the table
+				// and place whichever entry we are still carrying.
+				key_type key = result == npos ? value.first : slots[result].first;
+				rehash(slots.size()*2);
+				insert_slot(value, hash_of(value.first));
+				find_slot(key, hash_of(key), result);
+				return result;
+			}
+		}
+
+		slots[i] = std::move(value);
+		dist[i] = d;
+		count++;
+		return result == npos ? i : result;
+	}
+
+	void erase_slot(size_t i)
+	{
+		size_t mask = slots.size()-1;
+		size_t next = (i+1) & mask;
+		while (dist[next] > 1)
+		{
+			slots[i] = std::move(slots[next]);
+			dist[i] = dist[next]-1;
+			i = next;
+			next = (i+1) & mask;
+		}
+		slots[i] = entry();
+		dist[i] = 0;
+		count--;
+	}
+
+	bool insert(const key_type &key, const value_type &value, iterator *loc = NULL)
+	{
+		uint64_t hash = hash_of(key);
+		size_t index;
+		bool inserted = !find_slot(key, hash, index);
+		if (inserted)
+			index = insert_slot(entry(key, value), hash);
+		if (loc != NULL)
+			*loc = iterator(this, index);
+		return inserted;
+	}
+
+	// Insert n entries at once, skipping keys that are already present
+	void insert(const entry *entries, size_t n)
+	{
+		vector<uint64_t> hashes(n);
+		hash_all(entries, n, hashes.data());
+		for (size_t i = 0; i < n; i++)
+		{
+			size_t index;
+			if (!find_slot(entries[i].first, hashes[i], index))
+			{
+				// Duplicates never need room, so only grow once a new key
+				// actually arrives, and then for every key that might follow.
+				if (count+1 > (size_t)(slots.size()*max_load))
+					reserve(count + n - i);
+				insert_slot(entries[i], hashes[i]);
+			}
+		}
+	}
+
+	void insert(const vector<entry> &entries)
+	{
+		insert(entries.data(), entries.size());
+	}
+
+	bool find(const key_type &key, iterator *loc = NULL)
+	{
+		size_t index;
+		bool found = find_slot(key, hash_of(key), index);
+		if (loc != NULL)
+			*loc = found ? iterator(this, index) : end();
+		return found;
+	}
+
+	bool find(const key_type &key, const_iterator *loc = NULL) const
+	{
+		size_t index;
+		bool found = find_slot(key, hash_of(key), index);
+		if (loc != NULL)
+			*loc = found ? const_iterator(this, index) : end();
+		return found;
+	}
+
+	bool contains(const key_type &key) const
+	{
+		size_t index;
+		return find_slot(key, hash_of(key), index);
+	}
+
+	template <class lookup_type, enable_lookup<key_type, lookup_type> = 0>
+	bool find(const lookup_type &key, iterator *loc = NULL)
+	{
+		size_t index;
+		bool found = find_slot(key, hash_of(key), index);
+		if (loc != NULL)
+			*loc = found ? iterator(this, index) : end();
+		return found;
+	}
+
+	template <class lookup_type, enable_lookup<key_type, lookup_type> = 0>
+	bool find(const lookup_type &key, const_iterator *loc = NULL) const
+	{
+		size_t index;
+		bool found = find_slot(key, hash_of(key), index);
+		if (loc != NULL)
+			*loc = found ? const_iterator(this, index) : end();
+		return found;
+	}
+
+	template <class lookup_type, enable_lookup<key_type, lookup_type> = 0>
+	bool contains(const lookup_type &key) const
+	{
+		size_t index;
+		return find_slot(key, hash_of(key), index);
+	}
+
+	// Erasing shifts the rest of the probe run back by one slot, which
+	// invalidates iterators to those entries.
+	void erase(iterator iter)
+	{
+		erase_slot(iter.index);
+	}
+
+	bool erase(const key_type &key)
+	{
+		size_t index;
+		if (!find_slot(key, hash_of(key), index))
+			return false;
+		erase_slot(index);
+		return true;
+	}
+
+	template <class lookup_type, enable_lookup<key_type, lookup_type> = 0>
+	bool erase(const lookup_type &key)
+	{
+		size_t index;
+		if (!find_slot(key, hash_of(key), index))
+			return false;
+		erase_slot(index);
+		return true;
+	}
+
+	value_type &operator[](const key_type &key)
+	{
+		uint64_t hash = hash_of(key);
+		size_t index;
+		if (!find_slot(key, hash, index))
+			index = insert_slot(entry(key, value_type()), hash);
+		return slots[index].second;
+	}
+
+	// Allocate enough slots to hold n entries without growing
+	void reserve(size_t n)
+	{
+		size_t capacity = 16;
+		while ((size_t)(capacity*max_load) < n)
+			capacity *= 2;
+		if (capacity > slots.size())
+			rehash(capacity);
+	}
+
+	// Move every entry into a fresh table of the given power of two size
+	void rehash(size_t capacity)
+	{
+		counters.rehash();
+		vector<entry> old_slots(capacity);
+		vector<uint8_t> old_dist(capacity, 0);
+		old_slots.swap(slots);
+		old_dist.swap(dist);
+		count = 0;
+
+		// Only hash the occupied slots, a run at a time so that raw byte
+		// keys still go through hash_batch.
+		vector<uint64_t> hashes(old_slots.size());
+		for (size_t i = 0; i < old_slots.size(); )
+		{
+			size_t j = i;
+			while (j < old_slots.size() && old_dist[j] != 0)
+				j++;
+			hash_all(old_slots.data() + i, j-i, hashes.data() + i);
+			for (; i < j; i++)
+				insert_slot(std::move(old_slots[i]), hashes[i]);
+			while (i < old_slots.size() && old_dist[i] == 0)
+				i++;
+		}
+	}
+
+	void clear()
+	{
+		slots.clear();
+		dist.clear();
+		count = 0;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	size_t capacity() const
+	{
+		return slots.size();
+	}
+
+	float load_factor() const
+	{
+		return slots.empty() ? 0.0f : (float)count/(float)slots.size();
+	}
+
+	hash_stats stats() const
+	{
+		hash_stats result;
+		result.chained = false;
+		result.size = count;
+		result.capacity = slots.size();
+		result.bytes = slots.size()*(sizeof(entry) + sizeof(uint8_t));
+		for (size_t i = 0; i < dist.size(); i++)
+			if (dist[i] != 0)
+				result.add(dist[i]-1);
+		result.count(counters);
+		return result;
+	}
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, slots.size()); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, slots.size()); }
+};
+
+// flat_hashset is a Swiss table style replacement for hashtable. Slots are
+// split into aligned groups of 16, and every slot has a control byte
+// holding either 7 bits of its value's hash or an empty/deleted marker. A
+// probe compares all 16 control bytes of a group against the hash at once
+// (SSE2 or NEON, with a scalar fallback) and only compares values whose
+// control bytes match. The value type must be default constructible.
+template <class value_type>
+struct flat_hashset
+{
+	static constexpr int group_size = 16;
+	static constexpr int8_t empty_ctrl = -128;
+	static constexpr int8_t deleted_ctrl = -2;
+
+	flat_hashset()
+	{
+		count = 0;
+		deleted = 0;
+	}
+
+	// ctrl[i] is empty_ctrl, deleted_ctrl, or the low 7 bits of the hash
+	// of slots[i].
+	vector<int8_t> ctrl;
+	vector<value_type> slots;
+	size_t count;
+	size_t deleted;
+	[[no_unique_address]] hash_counters counters;
+
+	static constexpr size_t npos = (size_t)-1;
+
+#if defined(__SSE2__)
+	static constexpr int match_shift = 0;
+
+	// Return a mask with one bit set for every byte of group equal to h.
+	static uint64_t match(const int8_t *group, int8_t h)
+	{
+		__m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+		return (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h)));
+	}
+#elif defined(__ARM_NEON)
+	static constexpr int match_shift = 2;
+
+	// NEON has no movemask. Narrowing the comparison leaves four bits per
+	// byte, of which we keep one.
+	static uint64_t match(const int8_t *group, int8_t h)
+	{
+		uint8x16_t eq = vceqq_s8(vld1q_s8(group), vdupq_n_s8(h));
+		uint8x8_t narrow = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+		return vget_lane_u64(vreinterpret_u64_u8(narrow), 0) & 0x8888888888888888ULL;
+	}
+#else
+	static constexpr int match_shift = 0;
+
+	static uint64_t match(const int8_t *group, int8_t h)
+	{
+		uint64_t result = 0;
+		for (int i = 0; i < group_size; i++)
+			result |= (uint64_t)(group[i] == h) << i;
+		return result;
+	}
+#endif
+
+	// Pop the lowest match out of a mask and return its slot in the group
+	static int next_match(uint64_t &mask)
+	{
+		int result = __builtin_ctzll(mask) >> match_shift;
+		mask &= mask-1;
+		return result;
+	}
+
+	struct iterator
+	{
+		iterator() : parent(NULL), index(0) {}
+		iterator(flat_hashset *parent, size_t index) : parent(parent), index(index)
+		{
+			skip();
+		}
+
+		flat_hashset *parent;
+		size_t index;
+
+		void skip()
+		{
+			while (index < parent->ctrl.size() && parent->ctrl[index] < 0)
+				index++;
+		}
+
+		const value_type &operator*() const { return parent->slots[index]; }
+		const value_type *operator->() const { return &parent->slots[index]; }
+		iterator &operator++() { index++; skip(); return *this; }
+		iterator operator++(int) { iterator tmp = *this; ++(*this); return tmp; }
+		bool operator==(const iterator &other) const { return index == other.index; }
+		bool operator!=(const iterator &other) const { return index != other.index; }
+	};
+
+	template <class lookup_type>
+	static uint64_t hash_of(const lookup_type &value)
+	{
+		return hasher(&value).get64();
+	}
+
+	static void hash_all(const value_type *values, size_t n, uint64_t *out)
+	{
+		if constexpr (hash_traits<value_type>::bytes)
+		{
+			static_assert(hash_unpadded<value_type>::value, "a value hashed as bytes must have no padding bytes");
+			hash_batch_bytes(values, sizeof(value_type), sizeof(value_type), n, out);
+		}
+		else
+		{
+			for (size_t i = 0; i < n; i++)
+				out[i] = hash_of(values[i]);
+		}
+	}
+
+	// Look for value given its precomputed hash. On success, index is set
+	// to its slot. Otherwise index is set to the first empty or deleted
+	// slot on its probe sequence, or npos if the table is full.
+	template <class lookup_type>
+	bool find_slot(const lookup_type &value, uint64_t hash, size_t &index) const
+	{
+		index = npos;
+		if (ctrl.empty())
+			return false;
+
+		int8_t h2 = (int8_t)(hash & 0x7F);
+		size_t mask = ctrl.size()/group_size - 1;
+		size_t group = (hash >> 7) & mask;
+		for (size_t step = 1; step <= mask+1; step++)
+		{
+			const int8_t *base = ctrl.data() + group*group_size;
+			uint64_t hits = match(base, h2);
+			while (hits != 0)
+			{
+				size_t i = group*group_size + next_match(hits);
+				if (slots[i] == value)
+				{
+					counters.lookup(step);
+					index = i;
+					return true;
+				}
+			}
+
+			uint64_t empties = match(base, empty_ctrl);
+			if (index == npos)
+			{
+				uint64_t avail = empties | match(base, deleted_ctrl);
+				if (avail != 0)
+					index = group*group_size + next_match(avail);
+			}
+
+			if (empties != 0)
+			{
+				counters.lookup(step);
+				return false;
+			}
+
+			// Triangular probing visits every group of a power of two table
+			group = (group + step) & mask;
+		}
+		counters.lookup(mask+1);
+		return false;
+	}
+
+	// Find the first empty slot on the probe sequence of a hash. This is
+	// only used while rehashing, where the table has no deleted slots and
+	// every value is known to be distinct.
+	size_t find_empty(uint64_t hash) const
+	{
+		size_t mask = ctrl.size()/group_size - 1;
+		size_t group = (hash >> 7) & mask;
+		for (size_t step = 1; ; step++)
+		{
+			uint64_t empties = match(ctrl.data() + group*group_size, empty_ctrl);
+			if (empties != 0)
+				return group*group_size + next_match(empties);
+			group = (group + step) & mask;
+		}
+	}
+
+	// Place a value known not to be in the table and return its slot
+	size_t insert_slot(const value_type &value, uint64_t hash, size_t index)
+	{
+		if (index == npos || (ctrl[index] == empty_ctrl && (count+deleted+1)*8 > ctrl.size()*7))
+		{
+			// Out of room. Double the table, unless clearing out the deleted
+			// slots would free enough space on its own.
+			size_t capacity = ctrl.empty() ? group_size : ctrl.size();
+			if ((count+1)*16 > capacity*7)
+				capacity *= 2;
+			rehash(capacity);
+			find_slot(value, hash, index);
+		}
+
+		if (ctrl[index] == deleted_ctrl)
+			deleted--;
+		ctrl[index] = (int8_t)(hash & 0x7F);
+		slots[index] = value;
+		count++;
+		return index;
+	}
+
+	void erase_slot(size_t i)
+	{
+		// Probes stop at the first group with an empty slot. If this group
+		// already has one, no probe can be passing through it and the slot
+		// may be marked empty outright.
+		const int8_t *base = ctrl.data() + (i/group_size)*group_size;
+		if (match(base, empty_ctrl) != 0)
+			ctrl[i] = empty_ctrl;
+		else
+		{
+			ctrl[i] = deleted_ctrl;
+			deleted++;
+		}
+		slots[i] = value_type();
+		count--;
+	}
+
+	bool insert(const value_type &value, iterator *loc = NULL)
+	{
+		uint64_t hash = hash_of(value);
+		size_t index;
+		bool inserted = !find_slot(value, hash, index);
+		if (inserted)
+			index = insert_slot(value, hash, index);
+		if (loc != NULL)
+			*loc = iterator(this, index);
+		return inserted;
+	}
+
+	// Insert n values at once, skipping those already present
+	void insert(const value_type *values, size_t n)
+	{
+		vector<uint64_t> hashes(n);
+		hash_all(values, n, hashes.data());
+		for (size_t i = 0; i < n; i++)
+		{
+			size_t index;
+			if (!find_slot(values[i], hashes[i], index))
+			{
+				// Duplicates never need room, so only grow once a new value
+				// actually arrives, and then for every value that might follow.
+				if (index == npos || (count+deleted+1)*8 > ctrl.size()*7)
+				{
+					reserve(count + n - i);
+					find_slot(values[i], hashes[i], index);
+				}
+				insert_slot(values[i], hashes[i], index);
+			}
+		}
+	}
+
+	void insert(const vector<value_type> &values)
+	{
+		insert(values.data(), values.size());
+	}
+
+	bool contains(const value_type &value, iterator *loc = NULL)
+	{
+		size_t index;
+		bool found = find_slot(value, hash_of(value), index);
+		if (loc != NULL)
+			*loc = found ? iterator(this, index) : end();
+		return found;
+	}
+
+	bool contains(const value_type &value) const
+	{
+		size_t index;
+		return find_slot(value, hash_of(value), index);
+	}
+
+	template <class lookup_type, enable_lookup<value_type, lookup_type> = 0>
+	bool contains(const lookup_type &value, iterator *loc = NULL)
+	{
+		size_t index;
+		bool found = find_slot(value, hash_of(value), index);
+		if (loc != NULL)
+			*loc = found ? iterator(this, index) : end();
+		return found;
+	}
+
+	template <class lookup_type, enable_lookup<value_type, lookup_type> = 0>
+	bool contains(const lookup_type &value) const
+	{
+		size_t index;
+		return find_slot(value, hash_of(value), index);
+	}
+
+	bool erase(const value_type &value)
+	{
+		size_t index;
+		if (!find_slot(value, hash_of(value), index))
+			return false;
+		erase_slot(index);
+		return true;
+	}
+
+	template <class lookup_type, enable_lookup<value_type, lookup_type> = 0>
+	bool erase(const lookup_type &value)
+	{
+		size_t index;
+		if (!find_slot(value, hash_of(value), index))
+			return false;
+		erase_slot(index);
+		return true;
+	}
+
+	void erase(iterator iter)
+	{
+		erase_slot(iter.index);
+	}
+
+	// Allocate enough slots to hold n values without growing
+	void reserve(size_t n)
+	{
+		size_t capacity = group_size;
+		while (capacity*7 < n*8)
+			capacity *= 2;
+		if (capacity > ctrl.size())
+			rehash(capacity);
+	}
+
+	// Move every value into a fresh table with the given power of two
+	// number of slots, dropping all deleted markers.
+	void rehash(size_t capacity)
+	{
+		counters.rehash();
+		vector<int8_t> old_ctrl(capacity, empty_ctrl);
+		vector<value_type> old_slots(capacity);
+		old_ctrl.swap(ctrl);
+		old_slots.swap(slots);
+		count = 0;
+		deleted = 0;
+
+		// Only hash the occupied slots, a run at a time so that raw byte
+		// values still go through hash_batch.
+		vector<uint64_t> hashes(old_slots.size());
+		for (size_t i = 0; i < old_ctrl.size(); )
+		{
+			size_t j = i;
+			while (j < old_ctrl.size() && old_ctrl[j] >= 0)
+				j++;
+			hash_all(old_slots.data() + i, j-i, hashes.data() + i);
+			for (; i < j; i++)
+			{
+				uint64_t hash = hashes[i];
+				size_t index = find_empty(hash);
+				ctrl[index] = (int8_t)(hash & 0x7F);
+				slots[index] = std::move(old_slots[i]);
+				count++;
+			}
+			while (i < old_ctrl.size() && old_ctrl[i] < 0)
+				i++;
+		}
+	}
+
+	void clear()
+	{
+		ctrl.clear();
+		slots.clear();
+		count = 0;
+		deleted = 0;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	size_t capacity() const
+	{
+		return ctrl.size();
+	}
+
+	float load_factor() const
+	{
+		return ctrl.empty() ? 0.0f : (float)count/(float)ctrl.size();
+	}
+
+	hash_stats stats() const
+	{
+		hash_stats result;
+		result.chained = false;
+		result.size = count;
+		result.capacity = ctrl.size();
+		result.bytes = ctrl.size()*(sizeof(value_type) + sizeof(int8_t));
+		if (!ctrl.empty())
+		{
+			// Walk each value's probe sequence to find how many groups past
+			// its home it landed.
+			size_t mask = ctrl.size()/group_size - 1;
+			for (size_t i = 0; i < ctrl.size(); i++)
+			{
+				if (ctrl[i] < 0)
+					continue;
+
+				size_t group = (hash_of(slots[i]) >> 7) & mask;
+				size_t step = 0;
+				while (group != i/group_size)
+					group = (group + ++step) & mask;
+				result.add(step);
+			}
+		}
+		result.count(counters);
+		return result;
+	}
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, ctrl.size()); }
+};
+
+// concurrent_hashmap spreads its keys over num_shards independent
+// flat_hashmaps by hash, the same way hashmap spreads them over buckets,
+// and guards every shard with its own reader/writer lock. Threads working
+// on different shards never contend, and lookups within a shard proceed in
+// parallel. Values are returned by copy since another thread may move the
+// entry as soon as the shard lock is released.
+template <class key_type, class value_type, int num_shards = 64>
+struct concurrent_hashmap
+{
+	// Keep every shard on its own cache line so that locking one shard does
+	// not invalidate its neighbors.
+	struct alignas(64) shard
+	{
+		mutable shared_mutex lock;
+		flat_hashmap<key_type, value_type> table;
+	};
+
+	array<shard, num_shards> shards;
+
+	template <class lookup_type>
+	static uint64_t hash_of(const lookup_type &key)
+	{
+		return hasher(&key).get64();
+	}
+
+	// flat_hashmap indexes its slots with the low bits of the hash, so pick
+	// the shard with the high bits.
+	shard &shard_of(uint64_t hash)
+	{
+		return shards[(hash >> 32)%num_shards];
+	}
+
+	const shard &shard_of(uint64_t hash) const
+	{
+		return shards[(hash >> 32)%num_shards];
+	}
+
+	bool insert(const key_type &key, const value_type &value)
+	{
+		uint64_t hash = hash_of(key);
+		shard &s = shard_of(hash);
+		unique_lock<shared_mutex> guard(s.lock);
+		size_t index;
+		if (s.table.find_slot(key, hash, index))
+			return false;
+		s.table.insert_slot(typename flat_hashmap<key_type, value_type>::entry(key, value), hash);
+		return true;
+	}
+
+	bool find(const key_type &key, value_type *result = NULL) const
+	{
+		return find_as(key, result);
+	}
+
+	// key may be any type that is hash_transparent with key_type
+	template <class lookup_type, enable_lookup<key_type, lookup_type> = 0>
+	bool find(const lookup_type &key, value_type *result = NULL) const
+	{
+		return find_as(key, result);
+	}
+
+	template <class lookup_type>
+	bool find_as(const lookup_type &key, value_type *result) const
+	{
+		uint64_t hash = hash_of(key);
+		const shard &s = shard_of(hash);
+		shared_lock<shared_mutex> guard(s.lock);
+		size_t index;
+		if (!s.table.find_slot(key, hash, index))
+			return false;
+		if (result != NULL)
+			*result = s.table.slots[index].second;
+		return true;
+	}
+
+	// Return the value stored under key. If there is none, construct(key) is
+	// called to make one. The constructor runs while the shard is locked, so
+	// it is called exactly once per key no matter how many threads race to
+	// insert it. It must not access this map.
+	template <class constructor>
+	value_type find_or_insert(const key_type &key, constructor construct, bool *inserted = NULL)
+	{
+		return find_or_insert_as(key, construct, inserted);
+	}
+
+	// A key given as a lookup type is only converted to key_type when it is
+	// inserted.
+	template <class lookup_type, class constructor, enable_lookup<key_type, lookup_type> = 0>
+	value_type find_or_insert(const lookup_type &key, constructor construct, bool *inserted = NULL)
+	{
+		return find_or_insert_as(key, construct, inserted);
+	}
+
+	template <class lookup_type, class constructor>
+	value_type find_or_insert_as(const lookup_type &key, constructor construct, bool *inserted)
+	{
+		uint64_t hash = hash_of(key);
+		shard &s = shard_of(hash);
+		size_t index;
+
+		{
+			shared_lock<shared_mutex> guard(s.lock);
+			if (s.table.find_slot(key, hash, index))
+			{
+				if (inserted != NULL)
+					*inserted = false;
+				return s.table.slots[index].second;
+			}
+		}
+
+		unique_lock<shared_mutex> guard(s.lock);
+		// Another thread may have inserted it between the two locks
+		bool found = s.table.find_slot(key, hash, index);
+		if (!found)
+			index = s.table.insert_slot(typename flat_hashmap<key_type, value_type>::entry(key_type(key), construct(key)), hash);
+		if (inserted != NULL)
+			*inserted = !found;
+		return s.table.slots[index].second;
+	}
+
+	bool erase(const key_type &key)
+	{
+		return erase_as(key);
+	}
+
+	template <class lookup_type, enable_lookup<key_type, lookup_type> = 0>
+	bool erase(const lookup_type &key)
+	{
+		return erase_as(key);
+	}
+
+	template <class lookup_type>
+	bool erase_as(const lookup_type &key)
+	{
+		uint64_t hash = hash_of(key);
+		shard &s = shard_of(hash);
+		unique_lock<shared_mutex> guard(s.lock);
+		size_t index;
+		if (!s.table.find_slot(key, hash, index))
+			return false;
+		s.table.erase_slot(index);
+		return true;
+	}
+
+	// Reserve room for n entries in total, assuming an even spread
+	void reserve(size_t n)
+	{
+		for (int i = 0; i < num_shards; i++)
+		{
+			unique_lock<shared_mutex> guard(shards[i].lock);
+			shards[i].table.reserve((n + num_shards - 1)/num_shards);
+		}
+	}
+
+	void clear()
+	{
+		for (int i = 0; i < num_shards; i++)
+		{
+			unique_lock<shared_mutex> guard(shards[i].lock);
+			shards[i].table.clear();
+		}
+	}
+
+	size_t size() const
+	{
+		size_t result = 0;
+		for (int i = 0; i < num_shards; i++)
+		{
+			shared_lock<shared_mutex> guard(shards[i].lock);
+			result += shards[i].table.size();
+		}
+		return result;
+	}
+
+	// Visit every entry, one shard at a time. Entries inserted or erased by
+	// other threads during the walk may or may not be seen.
+	template <class function>
+	void for_each(function f) const
+	{
+		for (int i = 0; i < num_shards; i++)
+		{
+			shared_lock<shared_mutex> guard(shards[i].lock);
+			for (auto j = shards[i].table.begin(); j != shards[i].table.end(); j++)
+				f(j->first, j->second);
+		}
+	}
+};
+
+// hashcons interns values. Every distinct value is stored exactly once in
+// an arena and named by a small integer id, so that structurally equal
+// values share storage and can be compared by id alone. Ids count up from
+// zero in order of first insertion. Interned values never move, so ids and
+// pointers remain valid until the table is cleared.
+template <class value_type>
+struct hashcons
+{
+	// The arena grows in blocks of 2^block_bits values
+	static const int block_bits = 10;
+	static const int block_size = 1 << block_bits;
+
+	// Index slots hold an id and the upper half of that id's hash, which
+	// rejects almost every mismatch without touching the arena.
+	struct slot
+	{
+		uint32_t tag;
+		int id;
+	};
+
+	hashcons()
+	{
+		count = 0;
+	}
+
+	hashcons(const hashcons &) = delete;
+	hashcons &operator=(const hashcons &) = delete;
+
+	~hashcons()
+	{
+		clear();
+	}
+
+	vector<value_type*> blocks;
+	vector<uint64_t> digests;
+	vector<slot> index;
+	int count;
+
+	template <class lookup_type>
+	static uint64_t hash_of(const lookup_type &value)
+	{
+		return hasher(&value).get64();
+	}
+
+	// Look for a value given its hash. Returns its id, or -1 with pos set to
+	// the empty slot where it belongs.
+	template <class lookup_type>
+	int find_slot(const lookup_type &value, uint64_t hash, size_t &pos) const
+	{
+		if (index.empty())
+			return -1;
+
+		size_t mask = index.size()-1;
+		uint32_t tag = (uint32_t)(hash >> 32);
+		for (pos = hash & mask; index[pos].id >= 0; pos = (pos+1) & mask)
+			if (index[pos].tag == tag && digests[index[pos].id] == hash && at(index[pos].id) == value)
+				return index[pos].id;
+		return -1;
+	}
+
+	int insert_slot(const value_type &value, uint64_t hash, size_t pos)
+	{
+		if ((size_t)(count+1)*4 > index.size()*3)
+		{
+			rehash(index.empty() ? 16 : index.size()*2);
+			find_slot(value, hash, pos);
+		}
+
+		if ((count >> block_bits) >= (int)blocks.size())
+			blocks.push_back((value_type*)::operator new(sizeof(value_type)*block_size, std::align_val_t(alignof(value_type))));
+		new (blocks[count >> block_bits] + (count & (block_size-1))) value_type(value);
+		digests.push_back(hash);
+
+		index[pos].tag = (uint32_t)(hash >> 32);
+		index[pos].id = count;
+		return count++;
+	}
+
+	// Return the id of value, adding it to the table if it is new
+	int intern(const value_type &value)
+	{
+		uint64_t hash = hash_of(value);
+		size_t pos = 0;
+		int id = find_slot(value, hash, pos);
+		if (id < 0)
+			id = insert_slot(value, hash, pos);
+		return id;
+	}
+
+	// Intern a value given as a lookup type, which is only converted to
+	// value_type if it is new.
+	template <class lookup_type, enable_lookup<value_type, lookup_type> = 0>
+	int intern(const lookup_type &value)
+	{
+		uint64_t hash = hash_of(value);
+		size_t pos = 0;
+		int id = find_slot(value, hash, pos);
+		if (id < 0)
+			id = insert_slot(value_type(value), hash, pos);
+		return id;
+	}
+
+	// Intern n values at once, writing their ids to ids. The index is sized
+	// up front so it grows at most once.
+	void intern(const value_type *values, int n, int *ids)
+	{
+		vector<uint64_t> hashes(n);
+		if constexpr (hash_traits<value_type>::bytes)
+			hash_batch(values, n, hashes.data());
+		else
+		{
+			for (int i = 0; i < n; i++)
+				hashes[i] = hash_of(values[i]);
+		}
+
+		reserve(count + n);
+		for (int i = 0; i < n; i++)
+		{
+			size_t pos = 0;
+			ids[i] = find_slot(values[i], hashes[i], pos);
+			if (ids[i] < 0)
+				ids[i] = insert_slot(values[i], hashes[i], pos);
+		}
+	}
+
+	vector<int> intern(const vector<value_type> &values)
+	{
+		vector<int> ids(values.size());
+		intern(values.data(), (int)values.size(), ids.data());
+		return ids;
+	}
+
+	// Return the id of value, or -1 if it has not been interned
+	int find(const value_type &value) const
+	{
+		size_t pos = 0;
+		return find_slot(value, hash_of(value), pos);
+	}
+
+	template <class lookup_type, enable_lookup<value_type, lookup_type> = 0>
+	int find(const lookup_type &value) const
+	{
+		size_t pos = 0;
+		return find_slot(value, hash_of(value), pos);
+	}
+
+	const value_type &at(int id) const
+	{
+		return blocks[id >> block_bits][id & (block_size-1)];
+	}
+
+	const value_type &operator[](int id) const
+	{
+		return at(id);
+	}
+
+	const value_type *ptr(int id) const
+	{
+		return &at(id);
+	}
+
+	int size() const
+	{
+		return count;
+	}
+
+	void reserve(int n)
+	{
+		size_t capacity = 16;
+		while (capacity*3 < (size_t)n*4)
+			capacity *= 2;
+		if (capacity > index.size())
+			rehash(capacity);
+		digests.reserve(n);
+	}
+
+	void rehash(size_t capacity)
+	{
+		slot empty = {0, -1};
+		index.assign(capacity, empty);
+		size_t mask = capacity-1;
+		for (int id = 0; id < count; id++)
+		{
+			size_t pos = digests[id] & mask;
+			while (index[pos].id >= 0)
+				pos = (pos+1) & mask;
+			index[pos].tag = (uint32_t)(digests[id] >> 32);
+			index[pos].id = id;
+		}
+	}
+
+	void clear()
+	{
+		for (int id = 0; id < count; id++)
+			blocks[id >> block_bits][id & (block_size-1)].~value_type();
+		for (int i = 0; i < (int)blocks.size(); i++)
+			::operator delete(blocks[i], std::align_val_t(alignof(value_type)));
+		blocks.clear();
+		digests.clear();
+		index.clear();
+		count = 0;
+	}
+};
+
+// perfect_hash maps a fixed set of n keys onto [0, n) without collisions,
+// using the BBHash construction. Level 0 is a bit array of about gamma*n
+// bits. Every key hashes to one position in it, and the keys that land
+// alone on their position set that bit. The keys that collided move on to
+// the next, smaller level, and so on. The index of a key is the number of
+// set bits before its own across all levels, which a rank table answers
+// with one lookup and a couple of popcounts. The few keys still colliding
+// after max_levels go into a small fallback table.
+//
+// With the default gamma of 1, the structure takes about 3.5 bits per key
+// and a lookup visits fewer than two levels on average. Raising gamma
+// trades space for fewer levels. Looking up a key that was not in the set
+// returns an arbitrary index, or npos.
+struct perfect_hash
+{
+	perfect_hash(double gamma = 1.0);
+	~perfect_hash();
+
+	static constexpr size_t npos = (size_t)-1;
+	static constexpr int max_levels = 32;
+	// rank is stored once per block of 8 words
+	static constexpr int rank_block = 8;
+
+	double gamma;
+	size_t count;
+	// The bits of every level, concatenated. Level i starts at word
+	// offsets[i] and ends at offsets[i+1].
+	vector<uint64_t> bits;
+	vector<uint64_t> offsets;
+	// ranks[i] is the number of bits set before word i*rank_block
+	vector<uint32_t> ranks;
+	flat_hashmap<uint64_t, uint32_t> fallback;
+
+	// Build from the 64-bit hasher digests of the keys. Repeated digests
+	// are only counted once.
+	void build(const uint64_t *hashes, size_t n);
+	size_t find_hash(uint64_t hash) const;
+
+	template <class type>
+	void build(const type *keys, size_t n)
+	{
+		vector<uint64_t> hashes(n);
+		if constexpr (hash_traits<type>::bytes)
+			hash_batch(keys, n, hashes.data());
+		else
+		{
+			for (size_t i = 0; i < n; i++)
+				hashes[i] = hasher(keys + i).get64();
+		}
+		build(hashes.data(), n);
+	}
+
+	template <class type>
+	void build(const vector<type> &keys)
+	{
+		build(keys.data(), keys.size());
+	}
+
+	template <class type>
+	size_t find(const type &key) const
+	{
+		return find_hash(hasher(&key).get64());
+	}
+
+	template <class type>
+	size_t operator()(const type &key) const
+	{
+		return find_hash(hasher(&key).get64());
+	}
+
+	size_t size() const;
+	size_t bytes() const;
+	void clear();
+
+	bool save(string path) const;
+	bool load(string path);
+};
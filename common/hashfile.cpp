@@ -0,0 +1,314 @@
+#include "hashfile.h"
+#include "message.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char hashfile_magic[8] = {'H', 'A', 'S', 'H', 'F', 'I', 'L', 'E'};
+static const uint32_t hashfile_version = 1;
+
+static uint64_t hash_key(const void *key, size_t key_size)
+{
+	hasher h;
+	h.write(key, key_size);
+	return h.get64();
+}
+
+static uint64_t align8(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+hashfile_builder::hashfile_builder(size_t value_size)
+{
+	this->value_size = value_size;
+}
+
+hashfile_builder::~hashfile_builder()
+{
+}
+
+void hashfile_builder::add(const void *key, size_t key_size, const void *value)
+{
+	entries.push_back(pair<uint64_t, uint32_t>(keys.size(), (uint32_t)key_size));
+	keys.insert(keys.end(), (const char *)key, (const char *)key + key_size);
+	values.insert(values.end(), (const char *)value, (const char *)value + value_size);
+}
+
+// Lay the table out in memory exactly as it will appear in the file, then
+// write it with a single call. If a key was added more than once, the
+// first value wins.
+bool hashfile_builder::write(string path) const
+{
+	uint64_t capacity = 16;
+	while (capacity < 2*entries.size())
+		capacity *= 2;
+
+	vector<hashfile_slot> slots(capacity);
+	for (uint64_t i = 0; i < capacity; i++)
+	{
+		slots[i].hash = 0;
+		slots[i].key_offset = 0;
+		slots[i].key_size = 0;
+		slots[i].value = hashfile_slot::empty;
+	}
+
+	uint64_t count = 0;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const char *key = keys.data() + entries[i].first;
+		uint64_t hash = hash_key(key, entries[i].second);
+		uint64_t pos = hash & (capacity-1);
+		bool found = false;
+		while (slots[pos].value != hashfile_slot::empty)
+		{
+			if (slots[pos].hash == hash && slots[pos].key_size == entries[i].second
+				&& memcmp(keys.data() + slots[pos].key_offset, key, entries[i].second) == 0)
+			{
+				found = true;
+				break;
+			}
+			pos = (pos+1) & (capacity-1);
+		}
+
+		if (!found)
+		{
+			slots[pos].hash = hash;
+			slots[pos].key_offset = entries[i].first;
+			slots[pos].key_size = entries[i].second;
+			slots[pos].value = (uint32_t)i;
+			count++;
+		}
+	}
+
+	hashfile_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, hashfile_magic, sizeof(header.magic));
+	header.version = hashfile_version;
+	header.value_size = (uint32_t)value_size;
+	header.count = count;
+	header.capacity = capacity;
+	header.slots_offset = align8(sizeof(hashfile_header));
+	header.values_offset = align8(header.slots_offset + capacity*sizeof(hashfile_slot));
+	header.keys_offset = align8(header.values_offset + values.size());
+	header.file_size = header.keys_offset + keys.size();
+
+	vector<char> buffer(header.file_size, 0);
+	memcpy(buffer.data(), &header, sizeof(header));
+	memcpy(buffer.data() + header.slots_offset, slots.data(), capacity*sizeof(hashfile_slot));
+	if (!values.empty())
+		memcpy(buffer.data() + header.values_offset, values.data(), values.size());
+	if (!keys.empty())
+		memcpy(buffer.data() + header.keys_offset, keys.data(), keys.size());
+
+	FILE *fptr = fopen(path.c_str(), "wb");
+	if (fptr == NULL)
+	{
+		error(path, "unable to open hashfile for writing", __FILE__, __LINE__);
+		return false;
+	}
+
+	bool success = fwrite(buffer.data(), 1, buffer.size(), fptr) == buffer.size();
+	success = fclose(fptr) == 0 && success;
+	if (!success)
+		error(path, "unable to write hashfile", __FILE__, __LINE__);
+	return success;
+}
+
+void hashfile_builder::clear()
+{
+	keys.clear();
+	values.clear();
+	entries.clear();
+}
+
+hashfile::hashfile()
+{
+	data = NULL;
+	size = 0;
+	mapped = false;
+}
+
+hashfile::~hashfile()
+{
+	close();
+}
+
+const hashfile_header *hashfile::header() const
+{
+	return (const hashfile_header *)data;
+}
+
+const hashfile_slot *hashfile::slots() const
+{
+	return (const hashfile_slot *)(data + header()->slots_offset);
+}
+
+bool hashfile::open(string path, size_t value_size)
+{
+	close();
+
+#ifndef WIN32
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		error(path, "unable to open hashfile", __FILE__, __LINE__);
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(hashfile_header))
+	{
+		::close(fd);
+		error(path, "hashfile is truncated", __FILE__, __LINE__);
+		return false;
+	}
+
+	void *ptr = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (ptr == MAP_FAILED)
+	{
+		error(path, "unable to map hashfile", __FILE__, __LINE__);
+		return false;
+	}
+
+	data = (const char *)ptr;
+	size = info.st_size;
+	mapped = true;
+#else
+	// No mmap, so fall back to reading the whole file
+	FILE *fptr = fopen(path.c_str(), "rb");
+	if (fptr == NULL)
+	{
+		error(path, "unable to open hashfile", __FILE__, __LINE__);
+		return false;
+	}
+
+	fseek(fptr, 0, SEEK_END);
+	long length = ftell(fptr);
+	fseek(fptr, 0, SEEK_SET);
+	if (length < (long)sizeof(hashfile_header))
+	{
+		fclose(fptr);
+		error(path, "hashfile is truncated", __FILE__, __LINE__);
+		return false;
+	}
+
+	char *buffer = new char[length];
+	size_t read = fread(buffer, 1, length, fptr);
+	fclose(fptr);
+	data = buffer;
+	size = read;
+	mapped = false;
+#endif
+
+	const hashfile_header *h = header();
+	if (memcmp(h->magic, hashfile_magic, sizeof(h->magic)) != 0 || h->version != hashfile_version)
+	{
+		close();
+		error(path, "not a hashfile", __FILE__, __LINE__);
+		return false;
+	}
+
+	if (h->value_size != value_size)
+	{
+		close();
+		error(path, "hashfile value size does not match", __FILE__, __LINE__);
+		return false;
+	}
+
+	if (!valid())
+	{
+		close();
+		error(path, "hashfile is corrupt", __FILE__, __LINE__);
+		return false;
+	}
+
+	return true;
+}
+
+// Check that every section lies within the file and that every slot points
+// inside its sections, so that find() can trust the contents without any
+// further checks. The slot count is bounded by the file size before it is
+// multiplied, so nothing here can overflow.
+bool hashfile::valid() const
+{
+	const hashfile_header *h = header();
+	if (h->file_size != size || h->capacity == 0 || (h->capacity & (h->capacity-1)) != 0
+		|| h->slots_offset < sizeof(hashfile_header) || h->slots_offset % 8 != 0
+		|| h->slots_offset > h->values_offset || h->values_offset > h->keys_offset
+		|| h->keys_offset > h->file_size
+		|| h->capacity > (h->values_offset - h->slots_offset)/sizeof(hashfile_slot))
+		return false;
+
+	uint64_t num_values = h->value_size == 0 ? (uint64_t)hashfile_slot::empty : (h->keys_offset - h->values_offset)/h->value_size;
+	uint64_t keys_size = h->file_size - h->keys_offset;
+	const hashfile_slot *table = slots();
+	uint64_t count = 0;
+	for (uint64_t i = 0; i < h->capacity; i++)
+	{
+		if (table[i].value == hashfile_slot::empty)
+			continue;
+		if (table[i].value >= num_values || table[i].key_offset > keys_size
+			|| table[i].key_size > keys_size - table[i].key_offset)
+			return false;
+		count++;
+	}
+
+	// find() stops at the first empty slot, so there must be one
+	return count == h->count && count < h->capacity;
+}
+
+void hashfile::close()
+{
+	if (data != NULL)
+	{
+#ifndef WIN32
+		if (mapped)
+			munmap((void*)data, size);
+		else
+			delete [] data;
+#else
+		delete [] data;
+#endif
+	}
+	data = NULL;
+	size = 0;
+	mapped = false;
+}
+
+bool hashfile::is_open() const
+{
+	return data != NULL;
+}
+
+const char *hashfile::find(const void *key, size_t key_size) const
+{
+	if (data == NULL)
+		return NULL;
+
+	const hashfile_header *h = header();
+	const hashfile_slot *table = slots();
+	const char *keys = data + h->keys_offset;
+	uint64_t hash = hash_key(key, key_size);
+	uint64_t mask = h->capacity-1;
+	for (uint64_t pos = hash & mask; table[pos].value != hashfile_slot::empty; pos = (pos+1) & mask)
+	{
+		if (table[pos].hash == hash && table[pos].key_size == key_size
+			&& memcmp(keys + table[pos].key_offset, key, key_size) == 0)
+			return data + h->values_offset + (uint64_t)table[pos].value*h->value_size;
+	}
+	return NULL;
+}
+
+size_t hashfile::count() const
+{
+	return data == NULL ? 0 : header()->count;
+}
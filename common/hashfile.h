@@ -0,0 +1,155 @@
+#pragma once
+
+#include "hash.h"
+
+// A hashfile is a read-only hash table stored in a file in a form that can
+// be memory mapped and queried in place. Nothing is parsed or inserted when
+// the file is opened, only a single pass over the slots checks that they
+// stay within the file, so a table of millions of entries is ready to use
+// as soon as the operating system maps it in.
+//
+// The file is laid out as a header followed by three sections, all located
+// by byte offsets from the start of the file:
+//
+//   slots   capacity hashfile_slots, a linear probing table
+//   values  count fixed size values, indexed by hashfile_slot::value
+//   keys    the bytes of every key, packed end to end
+//
+// Keys are hashed with hasher, so a file is only readable on machines with
+// the same byte order as the one that wrote it.
+struct hashfile_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t value_size;
+	uint64_t count;
+	uint64_t capacity;
+	uint64_t slots_offset;
+	uint64_t values_offset;
+	uint64_t keys_offset;
+	uint64_t file_size;
+};
+
+struct hashfile_slot
+{
+	uint64_t hash;
+	uint64_t key_offset;
+	uint32_t key_size;
+	// index into the values section, or empty
+	uint32_t value;
+
+	static const uint32_t empty = 0xFFFFFFFF;
+};
+
+// Collects keys and values as raw bytes and writes them out as a hashfile
+struct hashfile_builder
+{
+	hashfile_builder(size_t value_size = 0);
+	~hashfile_builder();
+
+	size_t value_size;
+	vector<char> keys;
+	vector<char> values;
+	// offset and size of each key in keys
+	vector<pair<uint64_t, uint32_t> > entries;
+
+	void add(const void *key, size_t key_size, const void *value);
+	bool write(string path) const;
+	void clear();
+};
+
+// A read-only view of a hashfile
+struct hashfile
+{
+	hashfile();
+	hashfile(const hashfile &) = delete;
+	hashfile &operator=(const hashfile &) = delete;
+	~hashfile();
+
+	const char *data;
+	size_t size;
+	bool mapped;
+
+	const hashfile_header *header() const;
+	const hashfile_slot *slots() const;
+	bool valid() const;
+
+	bool open(string path, size_t value_size);
+	void close();
+	bool is_open() const;
+
+	// Return a pointer to the value stored under key, or NULL
+	const char *find(const void *key, size_t key_size) const;
+	size_t count() const;
+};
+
+// Keys are stored as their bytes. Strings store their characters, and any
+// type that hash_traits hashes as raw bytes stores those bytes. The file
+// hashes those bytes with hasher::write, so string digests do not carry the
+// length prefix that hasher(&key) gives them.
+template <class key_type>
+string_view hashfile_key(const key_type &key)
+{
+	if constexpr (is_convertible<const key_type&, string_view>::value)
+		return string_view(key);
+	else
+	{
+		static_assert(hash_traits<key_type>::bytes, "hashfile keys must be strings or hashed as raw bytes");
+		return string_view((const char *)&key, sizeof(key_type));
+	}
+}
+
+template <class key_type, class value_type>
+struct hashfile_writer
+{
+	static_assert(is_trivially_copyable<value_type>::value, "hashfile values must be trivially copyable");
+
+	hashfile_writer() : builder(sizeof(value_type))
+	{
+	}
+
+	hashfile_builder builder;
+
+	void insert(const key_type &key, const value_type &value)
+	{
+		string_view bytes = hashfile_key(key);
+		builder.add(bytes.data(), bytes.size(), &value);
+	}
+
+	bool write(string path) const
+	{
+		return builder.write(path);
+	}
+};
+
+template <class key_type, class value_type>
+struct hashfile_map
+{
+	static_assert(is_trivially_copyable<value_type>::value, "hashfile values must be trivially copyable");
+
+	hashfile file;
+
+	bool open(string path)
+	{
+		return file.open(path, sizeof(value_type));
+	}
+
+	void close()
+	{
+		file.close();
+	}
+
+	bool find(const key_type &key, value_type *result = NULL) const
+	{
+		string_view bytes = hashfile_key(key);
+		const char *value = file.find(bytes.data(), bytes.size());
+		if (value != NULL && result != NULL)
+			memcpy((void*)result, value, sizeof(value_type));
+		return value != NULL;
+	}
+
+	size_t size() const
+	{
+		return file.count();
+	}
+};
@@ -4,61 +4,512 @@
 #include <optional>
 #include <iterator>
 #include <cstddef>
+#include <cstdint>
+#include <bit>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <stdexcept>
+#include "mapping.h"
+
+// index_bitset tracks which slots of an index_vector hold a live element,
+// packed 64 to a word. Scans use count-trailing-zeros, so runs of dead
+// slots are skipped a word at a time. The number of live slots is kept up
+// to date, and free_hint is the first word that may have a dead slot, so
+// repeatedly taking the lowest free slot is amortized O(1).
+struct index_bitset {
+	using size_type = std::size_t;
+	static constexpr size_type npos = size_type(-1);
+
+	std::vector<uint64_t> words;
+	size_type length = 0;
+	size_type live = 0;
+	mutable size_type free_hint = 0;
+
+	size_type size() const {
+		return length;
+	}
+
+	size_type count() const {
+		return live;
+	}
+
+	bool test(size_type i) const {
+		return i < length and ((words[i>>6] >> (i&63)) & 1);
+	}
+
+	void set(size_type i) {
+		uint64_t bit = uint64_t(1) << (i&63);
+		if (not (words[i>>6] & bit)) {
+			words[i>>6] |= bit;
+			live++;
+		}
+	}
+
+	void reset(size_type i) {
+		uint64_t bit = uint64_t(1) << (i&63);
+		if (words[i>>6] & bit) {
+			words[i>>6] &= ~bit;
+			live--;
+			if ((i>>6) < free_hint) {
+				free_hint = i>>6;
+			}
+		}
+	}
+
+	// Grow or shrink to n slots, new slots are dead
+	void resize(size_type n) {
+		words.resize((n+63)>>6, 0);
+		if (n < length) {
+			if ((n&63) != 0) {
+				words.back() &= ~(~uint64_t(0) << (n&63));
+			}
+			live = 0;
+			for (auto w : words) {
+				live += std::popcount(w);
+			}
+			free_hint = std::min(free_hint, words.size());
+		}
+		length = n;
+	}
 
+	// Make the first n slots live and drop the rest
+	void fill(size_type n) {
+		words.assign((n+63)>>6, ~uint64_t(0));
+		if ((n&63) != 0) {
+			words.back() = ~(~uint64_t(0) << (n&63));
+		}
+		length = n;
+		live = n;
+		free_hint = n>>6;
+	}
+
+	void push_back(bool value) {
+		resize(length+1);
+		if (value) {
+			set(length-1);
+		}
+	}
+
+	void clear() {
+		words.clear();
+		length = 0;
+		live = 0;
+		free_hint = 0;
+	}
+
+	// The first live slot at or after i, or size() if there is none
+	size_type next(size_type i) const {
+		if (i >= length) {
+			return length;
+		}
+		size_type w = i>>6;
+		uint64_t bits = words[w] & (~uint64_t(0) << (i&63));
+		while (bits == 0) {
+			if (++w >= words.size()) {
+				return length;
+			}
+			bits = words[w];
+		}
+		return (w<<6) + std::countr_zero(bits);
+	}
+
+	// The last live slot at or before i, or npos if there is none
+	size_type prev(size_type i) const {
+		if (i == npos or length == 0) {
+			return npos;
+		}
+		if (i >= length) {
+			i = length-1;
+		}
+		size_type w = i>>6;
+		uint64_t bits = words[w] & (~uint64_t(0) >> (63 - (i&63)));
+		while (bits == 0) {
+			if (w-- == 0) {
+				return npos;
+			}
+			bits = words[w];
+		}
+		return (w<<6) + 63 - std::countl_zero(bits);
+	}
+
+	// The lowest dead slot, or size() if every slot is live
+	size_type first_free() const {
+		if (live == length) {
+			return length;
+		}
+		while (free_hint < words.size() and words[free_hint] == ~uint64_t(0)) {
+			free_hint++;
+		}
+		size_type i = (free_hint<<6) + std::countr_zero(~words[free_hint]);
+		return i < length ? i : length;
+	}
+};
+
+// Storage for index_vector is raw memory. index_vector itself constructs
+// an element when it is emplaced and destroys it when it is erased, so a
+// dead slot holds no object at all. The storage only tracks memory.
+template<typename T>
+struct index_raw_delete {
+	void operator()(T *ptr) const {
+		::operator delete((void*)ptr, std::align_val_t(alignof(T)));
+	}
+};
+
+template<typename T>
+using index_raw_ptr = std::unique_ptr<T, index_raw_delete<T> >;
+
+template<typename T>
+index_raw_ptr<T> index_raw_allocate(std::size_t n) {
+	return index_raw_ptr<T>((T*)::operator new(n*sizeof(T), std::align_val_t(alignof(T))));
+}
+
+// index_buffer is the contiguous storage of an index_vector. When it grows,
+// only the live slots are moved to the new buffer.
 template<typename T>
+struct index_buffer {
+	using size_type = std::size_t;
+
+	index_raw_ptr<T> data;
+	size_type length = 0;
+	size_type reserved = 0;
+
+	T &operator[](size_type i) {
+		return data.get()[i];
+	}
+
+	const T &operator[](size_type i) const {
+		return data.get()[i];
+	}
+
+	size_type size() const {
+		return length;
+	}
+
+	size_type capacity() const {
+		return reserved;
+	}
+
+	// Cover n slots. Slots past the end are dead, and must already have been
+	// destroyed when shrinking. Elements are copied rather than moved if
+	// their move may throw, so a throw leaves the buffer as it was.
+	void resize(size_type n, const index_bitset &live) {
+		if (n > reserved) {
+			size_type grown = std::max(n, 2*reserved);
+			index_raw_ptr<T> next = index_raw_allocate<T>(grown);
+			size_type i = live.next(0);
+			try {
+				for (; i < length; i = live.next(i+1)) {
+					::new ((void*)(next.get() + i)) T(std::move_if_noexcept(data.get()[i]));
+				}
+			} catch (...) {
+				for (size_type j = live.next(0); j < i; j = live.next(j+1)) {
+					std::destroy_at(next.get() + j);
+				}
+				throw;
+			}
+			for (i = live.next(0); i < length; i = live.next(i+1)) {
+				std::destroy_at(data.get() + i);
+			}
+			data = std::move(next);
+			reserved = grown;
+		}
+		length = n;
+	}
+
+	void occupy(size_type) {
+	}
+
+	void vacate(size_type) {
+	}
+
+	void clear() {
+		data.reset();
+		length = 0;
+		reserved = 0;
+	}
+};
+
+// index_segments stores the elements of a segmented index_vector in blocks
+// that double in size, the first holding 64 slots, so an index is found
+// with a bit_width and a shift. Blocks are never reallocated, so pointers
+// and references to elements stay valid as the table grows, and growing
+// never copies anything. Each block counts its live slots, and is released
+// once the last of them is vacated. The most recently released block is
+// kept as a spare, so a loop that empties and refills the same block does
+// not allocate each time.
+template<typename T>
+struct index_segments {
+	using size_type = std::size_t;
+	static constexpr size_type base_bits = 6;
+
+	std::vector<index_raw_ptr<T> > blocks;
+	// the number of live slots in each block
+	std::vector<size_type> used;
+	size_type length = 0;
+	// the last block released, and which block it was
+	index_raw_ptr<T> spare;
+	size_type spare_of = 0;
+
+	static size_type block_size(size_type b) {
+		return size_type(1) << (b + base_bits);
+	}
+
+	static size_type block_of(size_type i) {
+		return std::bit_width((i >> base_bits) + 1) - 1;
+	}
+
+	static size_type offset_of(size_type i, size_type b) {
+		return i - (block_size(b) - block_size(0));
+	}
+
+	T &operator[](size_type i) {
+		size_type b = block_of(i);
+		return blocks[b].get()[offset_of(i, b)];
+	}
+
+	const T &operator[](size_type i) const {
+		size_type b = block_of(i);
+		return blocks[b].get()[offset_of(i, b)];
+	}
+
+	size_type size() const {
+		return length;
+	}
+
+	size_type capacity() const {
+		return ((size_type(1) << blocks.size()) - 1) << base_bits;
+	}
+
+	// Make the block table cover n slots without allocating any blocks
+	void resize(size_type n, const index_bitset &) {
+		if (n > 0) {
+			size_type b = block_of(n-1) + 1;
+			if (blocks.size() < b) {
+				blocks.resize(b);
+				used.resize(b, 0);
+			}
+		}
+		length = n;
+	}
+
+	// Mark slot i as live, allocating its block if needed
+	void occupy(size_type i) {
+		size_type b = block_of(i);
+		if (not blocks[b]) {
+			if (spare and spare_of == b) {
+				blocks[b] = std::move(spare);
+			} else {
+				blocks[b] = index_raw_allocate<T>(block_size(b));
+			}
+		}
+		used[b]++;
+	}
+
+	// Mark slot i as dead, freeing its block if it was the last live one
+	void vacate(size_type i) {
+		size_type b = block_of(i);
+		if (--used[b] == 0) {
+			spare = std::move(blocks[b]);
+			spare_of = b;
+		}
+	}
+
+	void clear() {
+		blocks.clear();
+		used.clear();
+		length = 0;
+		spare.reset();
+	}
+};
+
+// A handle names a slot of a generational index_vector along with the
+// generation of the element it was issued for. Once that element is erased
+// the slot's generation moves on, so the handle goes stale rather than
+// aliasing whatever is stored there next.
+struct index_handle {
+	uint32_t index;
+	uint32_t generation;
+
+	bool operator==(const index_handle &other) const = default;
+	bool operator!=(const index_handle &other) const = default;
+};
+
+struct index_no_generations {
+};
+
+// With generational set, every slot carries a 32-bit generation that is
+// bumped whenever its element is erased, and the *_handle functions are
+// available. Otherwise the generations take no space at all. With segmented
+// set, the elements are kept in index_segments rather than an index_buffer,
+// so they never move.
+template<typename T, bool generational = false, bool segmented = false>
 struct index_vector {
 	using value_type = T;
 	using size_type = std::size_t;
+	using handle_type = index_handle;
+	using storage_type = std::conditional_t<segmented, index_segments<T>, index_buffer<T> >;
 
-	std::vector<T> elems;
-	std::vector<bool> valid;
-	std::vector<size_t> free;
+	storage_type elems;
+	// which slots of elems hold a live element
+	index_bitset live;
+	// the current generation of each slot, covering at least elems
+	[[no_unique_address]] std::conditional_t<generational, std::vector<uint32_t>, index_no_generations> generations;
 
 	index_vector() = default;
 
-	// Add a new element, reusing index if possible
+	index_vector(const index_vector &other) : generations(other.generations) {
+		elems.resize(other.size(), live);
+		live.resize(other.size());
+		try {
+			for (size_type i = other.live.next(0); i < other.size(); i = other.live.next(i+1)) {
+				construct(i, other.elems[i]);
+			}
+		} catch (...) {
+			// The destructor does not run for a partly built object
+			destroy_all();
+			throw;
+		}
+	}
+
+	index_vector(index_vector &&other) noexcept {
+		swap(other);
+	}
+
+	index_vector &operator=(index_vector other) {
+		swap(other);
+		return *this;
+	}
+
+	~index_vector() {
+		destroy_all();
+	}
+
+	void swap(index_vector &other) noexcept {
+		std::swap(elems, other.elems);
+		std::swap(live, other.live);
+		std::swap(generations, other.generations);
+	}
+
+	// Add a new element, reusing the lowest free index if possible
 	template<typename... Args>
 	size_type emplace(Args&&... args) {
-		if (not free.empty()) {
-			size_type i = free.back(); free.pop_back();
-			elems[i] = T(std::forward<Args>(args)...);
-			valid[i] = true;
-			return i;
+		size_type i = live.first_free();
+		if (i >= elems.size()) {
+			if constexpr (not segmented) {
+				if (i >= elems.capacity()) {
+					// The arguments may refer to an element that growing the
+					// buffer moves, so build the new element first.
+					T value(std::forward<Args>(args)...);
+					grow(i + 1);
+					construct(i, std::move(value));
+					return i;
+				}
+			}
+			grow(i + 1);
 		}
-		elems.emplace_back(std::forward<Args>(args)...);
-		valid.push_back(true);
-		return elems.size() - 1;
+		construct(i, std::forward<Args>(args)...);
+		return i;
 	}
 
-	size_type next_index() const {
-		if (not free.empty()) {
-			return free.back();
+	// Extend the table with dead slots to cover n
+	void grow(size_type n) {
+		elems.resize(n, live);
+		live.resize(n);
+		cover_generations();
+	}
+
+	// Construct an element in the dead slot i
+	template<typename... Args>
+	void construct(size_type i, Args&&... args) {
+		elems.occupy(i);
+		try {
+			::new ((void*)&elems[i]) T(std::forward<Args>(args)...);
+		} catch (...) {
+			elems.vacate(i);
+			throw;
 		}
-		return elems.size();
+		live.set(i);
+	}
+
+	// Destroy the element in the live slot i
+	void destroy(size_type i) {
+		std::destroy_at(&elems[i]);
+		live.reset(i);
+		elems.vacate(i);
 	}
 
+	void destroy_all() {
+		if constexpr (not std::is_trivially_destructible<T>::value) {
+			for (size_type i = live.next(0); i < elems.size(); i = live.next(i+1)) {
+				std::destroy_at(&elems[i]);
+			}
+		}
+	}
+
+	// Add a new element and return a handle to it. Handles hold 32-bit
+	// indices, so this throws rather than fill a slot past UINT32_MAX.
+	template<typename... Args>
+	handle_type emplace_handle(Args&&... args) requires generational {
+		if (next_index() > UINT32_MAX) throw std::out_of_range("index_vector::emplace_handle() index does not fit in a handle");
+		return handle(emplace(std::forward<Args>(args)...));
+	}
+
+	// The handle of the element currently stored at index i
+	handle_type handle(size_type i) const requires generational {
+		if (i > UINT32_MAX) throw std::out_of_range("index_vector::handle() index does not fit in a handle");
+		return handle_type{(uint32_t)i, generations[i]};
+	}
+
+	// The index the next call to emplace() will use
+	size_type next_index() const {
+		return live.first_free();
+	}
+
+	// Replace the element at index i, or construct one there if the slot is
+	// dead, extending the table with dead slots as needed. Replacing an
+	// element retires the slot, so handles to the old one go stale.
+	//
+	// A dead slot is constructed in place, as in emplace(). The arguments
+	// may refer to the element being replaced, or to one that growing the
+	// buffer moves, so in those cases the new element is built first. If
+	// building it throws, the old element is left in place.
 	template<typename... Args>
 	void emplace_at(size_type i, Args&&... args) {
-		if (i >= elems.size()) {
-			size_type old_size = elems.size();
-			elems.resize(i + 1);
-			valid.resize(i + 1, false);
+		if (live.test(i)) {
+			T value(std::forward<Args>(args)...);
+			elems[i] = std::move(value);
+			retire(i);
+			return;
+		}
 
-			for (size_type j = old_size; j < i; ++j) {
-				free.push_back(j);
+		if (i >= elems.size()) {
+			if constexpr (not segmented) {
+				if (i >= elems.capacity()) {
+					T value(std::forward<Args>(args)...);
+					grow(i + 1);
+					construct(i, std::move(value));
+					return;
+				}
 			}
+			grow(i + 1);
 		}
+		construct(i, std::forward<Args>(args)...);
+	}
 
-		if (!valid[i]) {
-			auto it = std::find(free.begin(), free.end(), i);
-			if (it != free.end()) {
-				free.erase(it);
+	void cover_generations() {
+		if constexpr (generational) {
+			if (generations.size() < elems.size()) {
+				generations.resize(elems.size(), 0);
 			}
+		}
+	}
 
-			elems[i] = T(std::forward<Args>(args)...);
-			valid[i] = true;
-		} else {
-			elems[i] = T(std::forward<Args>(args)...);
+	// Invalidate any handle to slot i
+	void retire(size_type i) {
+		if constexpr (generational) {
+			generations[i]++;
 		}
 	}
 
@@ -68,23 +519,23 @@ struct index_vector {
 
 	bool erase(size_type i) {
 		if (is_valid(i)) {
-			valid[i] = false;
-			free.push_back(i);
+			destroy(i);
+			retire(i);
 			return true;
 		}
 		return false;
 	}
 
-	bool is_valid(size_type i) const {
-		return i < valid.size() and valid[i];
+	bool erase(handle_type h) requires generational {
+		return is_valid(h) and erase(h.index);
 	}
 
-	bool is_valid(typename std::vector<T>::iterator i) const {
-		return is_valid(i-elems.begin());
+	bool is_valid(size_type i) const {
+		return live.test(i);
 	}
 
-	bool is_valid(typename std::vector<T>::const_iterator i) const {
-		return is_valid(i-elems.begin());
+	bool is_valid(handle_type h) const requires generational {
+		return live.test(h.index) and generations[h.index] == h.generation;
 	}
 
 	T& at(size_type i) {
@@ -97,6 +548,16 @@ struct index_vector {
 		return elems[i];
 	}
 
+	T& at(handle_type h) requires generational {
+		if (not is_valid(h)) throw std::out_of_range("index_vector::at() stale handle");
+		return elems[h.index];
+	}
+
+	const T& at(handle_type h) const requires generational {
+		if (not is_valid(h)) throw std::out_of_range("index_vector::at() stale handle");
+		return elems[h.index];
+	}
+
 	T& operator[](size_type i) {
 		if (not is_valid(i)) throw std::out_of_range("index_vector::at() invalid index");
 		return elems[i];
@@ -116,29 +577,44 @@ struct index_vector {
 	}
 
 	size_type count() const {
-		return elems.size() - free.size();
+		return live.count();
 	}
 
+	// Generations are kept, so handles from before the clear stay stale
 	void clear() {
+		for (size_type i = live.next(0); i < elems.size(); i = live.next(i+1)) {
+			retire(i);
+		}
+		destroy_all();
 		elems.clear();
-		valid.clear();
-		free.clear();
+		live.clear();
 	}
 
-	void compact() {
-		std::vector<T> new_elems;
-		std::vector<bool> new_valid;
+	// Move the live elements down to the front in place, keeping their
+	// order, and return the mapping from old indices to new ones. Every old
+	// index is in the mapping, and those of dead slots map to size_type(-1),
+	// so the whole thing stays in a flat array however sparse the table
+	// was. Elements are renumbered, so every outstanding handle goes stale.
+	Mapping<size_type> compact() {
+		Mapping<size_type> result(size_type(-1), false);
 
+		size_type n = 0;
 		for (size_type i = 0; i < elems.size(); ++i) {
-			if (valid[i]) {
-				new_elems.push_back(std::move(elems[i]));
-				new_valid.push_back(true);
+			retire(i);
+			if (live.test(i)) {
+				if (i != n) {
+					construct(n, std::move(elems[i]));
+					destroy(i);
+				}
+				result.fwd.insert({i, n++});
+			} else {
+				result.fwd.insert({i, size_type(-1)});
 			}
 		}
 
-		elems = std::move(new_elems);
-		valid = std::move(new_valid);
-		free.clear();
+		elems.resize(n, live);
+		live.fill(n);
+		return result;
 	}
 
 	struct iterator {
@@ -149,13 +625,13 @@ struct index_vector {
 		using difference_type = std::ptrdiff_t;
 		
 		size_type index;
-		index_vector<T>* parent;
+		index_vector* parent;
 		
 		void skip_invalid() {
-			while (index < parent->elems.size() and not parent->valid[index]) ++index;
+			index = parent->live.next(index);
 		}
 
-		iterator(index_vector<T>* p, size_type i) : index(i), parent(p) { skip_invalid(); }
+		iterator(index_vector* p, size_type i) : index(i), parent(p) { skip_invalid(); }
 		reference operator*() const { return parent->elems[index]; }
 		pointer operator->() const { return &parent->elems[index]; }
 		iterator& operator++() { ++index; skip_invalid(); return *this; }
@@ -172,13 +648,13 @@ struct index_vector {
 		using difference_type = std::ptrdiff_t;
 
 		size_type index;
-		const index_vector<T>* parent;
+		const index_vector* parent;
 		
 		void skip_invalid() {
-			while (index < parent->elems.size() and not parent->valid[index]) ++index;
+			index = parent->live.next(index);
 		}
 
-		const_iterator(const index_vector<T>* p, size_type i) : index(i), parent(p) { skip_invalid(); }
+		const_iterator(const index_vector* p, size_type i) : index(i), parent(p) { skip_invalid(); }
 		reference operator*() const { return parent->elems[index]; }
 		pointer operator->() const { return &parent->elems[index]; }
 		const_iterator& operator++() { ++index; skip_invalid(); return *this; }
@@ -195,14 +671,13 @@ struct index_vector {
 		using difference_type = std::ptrdiff_t;
 
 		size_type index;
-		index_vector<T>* parent;
+		index_vector* parent;
 
 		void skip_invalid_reverse() {
-			while (index != size_type(-1) and not parent->valid[index])
-				--index;
+			index = parent->live.prev(index);
 		}
 
-		reverse_iterator(index_vector<T>* p, size_type i) : index(i), parent(p) { skip_invalid_reverse(); }
+		reverse_iterator(index_vector* p, size_type i) : index(i), parent(p) { skip_invalid_reverse(); }
 
 		reference operator*() const { return parent->elems[index]; }
 		pointer operator->() const { return &parent->elems[index]; }
@@ -232,14 +707,13 @@ struct index_vector {
 		using difference_type = std::ptrdiff_t;
 		
 		size_type index;
-		const index_vector<T>* parent;
+		const index_vector* parent;
 
 		void skip_invalid_reverse() {
-			while (index != size_type(-1) and not parent->valid[index])
-				--index;
+			index = parent->live.prev(index);
 		}
 
-		const_reverse_iterator(const index_vector<T>* p, size_type i)
+		const_reverse_iterator(const index_vector* p, size_type i)
 				: index(i), parent(p) {
 			skip_invalid_reverse();
 		}
@@ -277,23 +751,28 @@ struct index_vector {
 	const_reverse_iterator rend() const   { return const_reverse_iterator(this, size_type(-1)); }
 };
 
-template <typename T>
-size_t operator-(typename index_vector<T>::iterator a, typename index_vector<T>::iterator b) {
+template <typename T, bool G, bool S>
+size_t operator-(typename index_vector<T, G, S>::iterator a, typename index_vector<T, G, S>::iterator b) {
 	return a.index - b.index;
 }
 
-template <typename T>
-size_t operator-(typename index_vector<T>::const_iterator a, typename index_vector<T>::const_iterator b) {
+template <typename T, bool G, bool S>
+size_t operator-(typename index_vector<T, G, S>::const_iterator a, typename index_vector<T, G, S>::const_iterator b) {
 	return a.index - b.index;
 }
 
-template <typename T>
-size_t operator-(typename index_vector<T>::reverse_iterator a, typename index_vector<T>::reverse_iterator b) {
+template <typename T, bool G, bool S>
+size_t operator-(typename index_vector<T, G, S>::reverse_iterator a, typename index_vector<T, G, S>::reverse_iterator b) {
 	return a.index - b.index;
 }
 
-template <typename T>
-size_t operator-(typename index_vector<T>::const_reverse_iterator a, typename index_vector<T>::const_reverse_iterator b) {
+template <typename T, bool G, bool S>
+size_t operator-(typename index_vector<T, G, S>::const_reverse_iterator a, typename index_vector<T, G, S>::const_reverse_iterator b) {
 	return a.index - b.index;
 }
 
+template <typename T>
+using generational_index_vector = index_vector<T, true>;
+
+template <typename T>
+using segmented_index_vector = index_vector<T, false, true>;
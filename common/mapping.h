@@ -2,8 +2,17 @@
 
 #include <vector>
 #include <map>
+#include <set>
 #include <ostream>
+#include <type_traits>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <span>
+#include <algorithm>
+#include <cstdint>
 #include "message.h"
+#include "dense_map.h"
 
 // Mapping is used to transform from one index space to another.  If you are
 // applying iterative transformations to a single thing, then create separate
@@ -21,6 +30,20 @@
 // cout << m0 << endl;
 
 // mapping identity -> {1 -> 5, 2 -> 7, 3 -> 7}
+
+// The forward map of a Mapping. Integral index spaces use a DenseMap, which
+// looks entries up in a flat array while the keys allow it, and everything
+// else uses a std::map.
+template <typename T, typename V = T, typename Enable = void>
+struct MappingStore {
+	using type = std::map<T, V>;
+};
+
+template <typename T, typename V>
+struct MappingStore<T, V, std::enable_if_t<std::is_integral<T>::value and not std::is_same<T, bool>::value> > {
+	using type = DenseMap<T, V>;
+};
+
 template <typename T>
 struct Mapping {
 	Mapping(T undef=T(), bool identity = true) {
@@ -31,7 +54,7 @@ struct Mapping {
 	~Mapping() {
 	}
 
-	std::map<T, T> fwd;
+	typename MappingStore<T>::type fwd;
 	bool identity;
 	T undef;
 
@@ -104,41 +127,67 @@ struct Mapping {
 		return undef;
 	}
 
-	std::vector<T> map(std::vector<T> from) const {
-		std::vector<T> result;
-		for (auto i = from.begin(); i != from.end(); i++) {
-			auto pos = fwd.find(*i);
+	// Map n ids from "from" into "out", dropping ids that map to undef the
+	// same as map(vector), and return the number written. out may be the
+	// same array as from. Dense mappings of 32-bit ids use SIMD gathers.
+	size_t mapRange(const T *from, size_t n, T *out) const {
+		if constexpr (sizeof(T) == 4 and std::is_same<typename MappingStore<T>::type, DenseMap<T> >::value) {
+			if (fwd.isDense()) {
+				return denseMapGather32((const uint32_t*)fwd.slots.data(), fwd.slots.size(), (const uint32_t*)from, n, (uint32_t*)out, identity, (uint32_t)undef);
+			}
+		}
+
+		size_t k = 0;
+		for (size_t i = 0; i < n; i++) {
+			auto pos = fwd.find(from[i]);
 			if (pos != fwd.end()) {
 				if (pos->second != undef) {
-					result.push_back(pos->second);
+					out[k++] = pos->second;
 				}
 			} else if (identity) {
-				result.push_back(*i);
+				out[k++] = from[i];
 			}
 		}
+		return k;
+	}
+
+	// Map ids in place, packing the results at the front. Returns how many
+	// remain.
+	size_t mapInPlace(std::span<T> ids) const {
+		return mapRange(ids.data(), ids.size(), ids.data());
+	}
+
+	// Map from into result, reusing its storage
+	void mapInto(std::span<const T> from, std::vector<T> &result) const {
+		result.resize(from.size());
+		result.resize(mapRange(from.data(), from.size(), result.data()));
+	}
+
+	// Map from into result, then sort and remove duplicates. The sort is
+	// skipped when the mapping preserved the order of sorted input.
+	void mapUniqInto(std::span<const T> from, std::vector<T> &result) const {
+		mapInto(from, result);
+		if (not std::is_sorted(result.begin(), result.end())) {
+			std::sort(result.begin(), result.end());
+		}
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+	}
+
+	std::vector<T> map(const std::vector<T> &from) const {
+		std::vector<T> result;
+		mapInto(from, result);
 		return result;
 	}
 
-	std::vector<T> mapUniq(std::vector<T> from) const {
+	std::vector<T> mapUniq(const std::vector<T> &from) const {
 		std::vector<T> result;
-		for (auto i = from.begin(); i != from.end(); i++) {
-			auto pos = fwd.find(*i);
-			if (pos != fwd.end()) {
-				if (pos->second != undef) {
-					result.push_back(pos->second);
-				}
-			} else if (identity) {
-				result.push_back(from);
-			}
-		}
-		sort(result.begin(), result.end());
-		result.erase(unique(result.begin(), result.end()), result.end());
+		mapUniqInto(from, result);
 		return result;
 	}
 
 	bool mapsTo(T t) const {
 		auto pos = fwd.find(t);
-		if ((identity and pos == fwd.end()) or pos->second == t) {
+		if (pos == fwd.end() ? identity : pos->second == t) {
 			return true;
 		}
 		for (auto i = fwd.begin(); i != fwd.end(); i++) {
@@ -214,13 +263,26 @@ struct Mapping {
 
 	Mapping<T> &operator+=(const Mapping<T> &m) {
 		for (auto i = m.fwd.begin(); i != m.fwd.end(); i++) {
-			fwd.set(*i);
+			fwd[i->first] = i->second;
 		}
 		return *this;
 	}
 
+	// Compose with m, so that the result maps x to m.map(this->map(x))
 	Mapping<T> &operator*=(const Mapping<T> &m) {
+		// Keys with no entry in an identity mapping map to themselves, so
+		// they now map wherever m sends them.
+		std::vector<std::pair<T, T> > added;
+		bool wasIdentity = identity;
 		identity = identity and m.identity;
+		if (wasIdentity) {
+			for (auto i = m.fwd.begin(); i != m.fwd.end(); i++) {
+				if (i->second != (identity ? i->first : undef) and fwd.find(i->first) == fwd.end()) {
+					added.push_back(*i);
+				}
+			}
+		}
+
 		for (auto i = fwd.begin(); i != fwd.end();) {
 			i->second = m.map(i->second);
 			if (i->second == (identity ? i->first : undef)) {
@@ -230,10 +292,8 @@ struct Mapping {
 			}
 		}
 
-		if (identity) {
-			for (auto i = m.fwd.begin(); i != m.fwd.end(); i++) {
-				fwd.insert(*i);
-			}
+		for (auto i = added.begin(); i != added.end(); i++) {
+			fwd.insert(*i);
 		}
 		return *this;
 	}
@@ -262,69 +322,324 @@ std::ostream &operator<<(std::ostream &os, const Mapping<T> &m) {
 	return os;
 }
 
-/*template <typename T>
+// MappingChain records a sequence of compositions and only evaluates them
+// when the result is needed. Single lookups walk the chain without
+// building anything, and flatten() reduces it to one Mapping. Composition
+// is associative, so flatten() combines neighboring pairs level by level
+// rather than folding left to right, optionally evaluating the pairs of a
+// level in parallel on at most one thread per core. Sparse mappings stay
+// small until the last few levels.
+//
+// MappingChain<int> chain(-1);
+// chain *= m0;
+// chain *= m1;
+// Mapping<int> m = chain.flatten();  // same as m0 * m1
+template <typename T>
+struct MappingChain {
+	MappingChain(T undef=T()) {
+		this->undef = undef;
+	}
+
+	~MappingChain() {
+	}
+
+	std::vector<Mapping<T> > links;
+	T undef;
+
+	// A level with fewer entries than this in total is composed serially,
+	// since starting the threads would cost more than the work.
+	static constexpr size_t parallel_threshold = 4096;
+
+	MappingChain<T> &operator*=(Mapping<T> m) {
+		links.push_back(std::move(m));
+		return *this;
+	}
+
+	MappingChain<T> &operator*=(const MappingChain<T> &m) {
+		links.insert(links.end(), m.links.begin(), m.links.end());
+		return *this;
+	}
+
+	T map(T from) const {
+		for (auto i = links.begin(); i != links.end(); i++) {
+			auto pos = i->fwd.find(from);
+			if (pos != i->fwd.end()) {
+				from = pos->second;
+			} else if (not i->identity) {
+				// No later mapping can recover an id that was dropped
+				return undef;
+			}
+		}
+		return from;
+	}
+
+	T operator[](T from) const {
+		return map(from);
+	}
+
+	size_t size() const {
+		return links.size();
+	}
+
+	bool empty() const {
+		return links.empty();
+	}
+
+	void clear() {
+		links.clear();
+	}
+
+	Mapping<T> flatten(bool parallel = false) const {
+		if (links.empty()) {
+			return Mapping<T>(undef);
+		}
+
+		std::vector<Mapping<T> > level = links;
+		while (level.size() > 1) {
+			size_t pairs = level.size()/2;
+			size_t workers = 1;
+			if (parallel and pairs > 1) {
+				size_t entries = 0;
+				for (auto i = level.begin(); i != level.end(); i++) {
+					entries += i->fwd.size();
+				}
+				if (entries >= parallel_threshold) {
+					workers = std::min(pairs, (size_t)std::max(std::thread::hardware_concurrency(), 1u));
+				}
+			}
+
+			if (workers > 1) {
+				// Each worker takes the next pair until there are none left
+				std::atomic<size_t> next(0);
+				std::vector<std::future<void> > tasks;
+				for (size_t w = 0; w < workers; w++) {
+					tasks.push_back(std::async(std::launch::async, [&level, &next, pairs]() {
+						for (size_t i = next++; i < pairs; i = next++) {
+							level[2*i] *= level[2*i+1];
+						}
+					}));
+				}
+				for (auto task = tasks.begin(); task != tasks.end(); task++) {
+					task->get();
+				}
+			} else {
+				for (size_t i = 0; i < pairs; i++) {
+					level[2*i] *= level[2*i+1];
+				}
+			}
+
+			for (size_t i = 1; i < pairs; i++) {
+				level[i] = std::move(level[2*i]);
+			}
+			if (level.size()%2 == 1) {
+				level[pairs] = std::move(level.back());
+				level.resize(pairs+1);
+			} else {
+				level.resize(pairs);
+			}
+		}
+		return std::move(level[0]);
+	}
+};
+
+// MappingBidir is a Mapping that also keeps a reverse index from each value
+// to the set of keys that map to it. It is updated along with every change,
+// which makes unmap, mapsTo, and toSize O(log n) and isBijective O(1), at
+// the cost of a tree insert per set. Every query returns the same result as
+// the equivalent Mapping. Modify it through its own functions only, since
+// changing fwd directly would leave the reverse index stale.
+template <typename T>
 struct MappingBidir {
-	MappingBidir(T undef=T(), bool identity = true) : fwd(undef, identity), bwd(undef, identity) {
+	MappingBidir(T undef=T(), bool identity = true) : fwd(undef, identity) {
+		overlaps = 0;
+		unmatched = 0;
+	}
+
+	MappingBidir(const Mapping<T> &m) : fwd(m) {
+		rebuild();
 	}
 
 	~MappingBidir() {
 	}
 
 	Mapping<T> fwd;
-	Mapping<T> bwd;
+	std::map<T, std::set<T> > bwd;
+
+	// The number of values with more than one key
+	size_t overlaps;
+	// The number of values that are not also keys
+	size_t unmatched;
+
+	bool hasKey(T t) const {
+		return fwd.fwd.find(t) != fwd.fwd.end();
+	}
+
+	void link(T from, T to) {
+		std::set<T> &keys = bwd[to];
+		keys.insert(from);
+		if (keys.size() == 1) {
+			unmatched += (size_t)(not hasKey(to));
+		} else if (keys.size() == 2) {
+			overlaps++;
+		}
+	}
+
+	void unlink(T from, T to) {
+		auto pos = bwd.find(to);
+		pos->second.erase(from);
+		if (pos->second.size() == 1) {
+			overlaps--;
+		} else if (pos->second.empty()) {
+			bwd.erase(pos);
+			unmatched -= (size_t)(not hasKey(to));
+		}
+	}
+
+	void insertKey(T from, T to) {
+		fwd.fwd.insert({from, to});
+		unmatched -= (size_t)(bwd.find(from) != bwd.end());
+		link(from, to);
+	}
+
+	void eraseKey(T from) {
+		auto pos = fwd.fwd.find(from);
+		unlink(from, pos->second);
+		fwd.fwd.erase(pos);
+		unmatched += (size_t)(bwd.find(from) != bwd.end());
+	}
+
+	// Recompute the reverse index from fwd
+	void rebuild() {
+		bwd.clear();
+		overlaps = 0;
+		unmatched = 0;
+		for (auto i = fwd.fwd.begin(); i != fwd.fwd.end(); i++) {
+			link(i->first, i->second);
+		}
+	}
 
 	void set(T from, T to) {
-		fwd.set(from, to);
-		bwd.set(to, from);
+		auto pos = fwd.fwd.find(from);
+		if (pos == fwd.fwd.end()) {
+			insertKey(from, to);
+		} else if (pos->second != to) {
+			unlink(from, pos->second);
+			pos->second = to;
+			link(from, to);
+		}
+	}
+
+	void set(std::initializer_list<T> from, T to) {
+		for (auto i = from.begin(); i != from.end(); i++) {
+			set(*i, to);
+		}
+	}
+
+	void set(std::vector<T> from, T to) {
+		for (auto i = from.begin(); i != from.end(); i++) {
+			set(*i, to);
+		}
 	}
 
 	void set(std::initializer_list<std::pair<T, T> > m) {
 		for (auto i = m.begin(); i != m.end(); i++) {
-			fwd.set(i->first, i->second);
-			bwd.set(i->second, i->first);
+			set(i->first, i->second);
 		}
 	}
 
 	void set(std::map<T, T> m) {
 		for (auto i = m.begin(); i != m.end(); i++) {
-			fwd.set(i->first, i->second);
-			bwd.set(i->second, i->first);
+			set(i->first, i->second);
 		}
 	}
 
+	// Same as Mapping::update, but only visits the keys that map to from
 	void update(T from, T to) {
-		fwd.update(from, to);
-		bwd.update(to, from);
+		auto pos = bwd.find(from);
+		if (pos != bwd.end() and from != to) {
+			std::set<T> keys = pos->second;
+			for (auto i = keys.begin(); i != keys.end(); i++) {
+				set(*i, to);
+			}
+		}
+
+		if (not fwd.identity) {
+			pos = bwd.find(fwd.undef);
+			if (pos != bwd.end()) {
+				std::set<T> keys = pos->second;
+				for (auto i = keys.begin(); i != keys.end(); i++) {
+					eraseKey(*i);
+				}
+			}
+		}
+
+		if (not hasKey(from)) {
+			insertKey(from, to);
+		}
 	}
 
 	T unmap(T to) const {
-		return bwd.map(to);
+		auto pos = bwd.find(to);
+		if (pos != bwd.end()) {
+			return *pos->second.begin();
+		} else if (fwd.identity) {
+			return to;
+		}
+		return fwd.undef;
 	}
-	
+
 	T map(T from) const {
 		return fwd.map(from);
 	}
 
-	std::vector<T> map(std::vector<T> from) const {
+	std::vector<T> map(const std::vector<T> &from) const {
 		return fwd.map(from);
 	}
 
-	std::vector<T> mapUniq(std::vector<T> from) const {
+	std::vector<T> mapUniq(const std::vector<T> &from) const {
 		return fwd.mapUniq(from);
 	}
 
 	bool mapsTo(T t) const {
-		return bwd.mapsFrom(t);
+		auto pos = fwd.fwd.find(t);
+		if (pos == fwd.fwd.end() ? fwd.identity : pos->second == t) {
+			return true;
+		}
+		return bwd.find(t) != bwd.end();
 	}
 
 	bool mapsFrom(T t) const {
 		return fwd.mapsFrom(t);
 	}
 
+	bool isBijective() const {
+		return overlaps > 0 or (fwd.identity and unmatched > 0);
+	}
+
+	size_t toSize() const {
+		return bwd.size();
+	}
+
+	size_t fromSize() const {
+		return fwd.fromSize();
+	}
+
+	T toMax() const {
+		if (bwd.empty()) {
+			return T();
+		}
+		return bwd.rbegin()->first;
+	}
+
 	MappingBidir flip() const {
-		MappingBidir result(undef, identity);
-		result.fwd = bwd;
-		result.bwd = fwd;
+		if (overlaps > 0) {
+			internal("", "unable to flip mapping with overlapping assignments", __FILE__, __LINE__);
+		}
+
+		MappingBidir result(fwd.undef, fwd.identity);
+		for (auto i = bwd.begin(); i != bwd.end(); i++) {
+			result.set(i->first, *i->second.begin());
+		}
 		return result;
 	}
 
@@ -333,14 +648,333 @@ struct MappingBidir {
 	}
 
 	MappingBidir<T> &operator+=(const Mapping<T> &m) {
-		fwd += m;
-		bwd = m.flip() + bwd;
+		for (auto i = m.fwd.begin(); i != m.fwd.end(); i++) {
+			set(i->first, i->second);
+		}
 		return *this;
 	}
 
+	// Composition rewrites every entry, so the reverse index is rebuilt
 	MappingBidir<T> &operator*=(const Mapping<T> &m) {
 		fwd *= m;
-		bwd = m.flip()*bwd;
+		rebuild();
 		return *this;
 	}
-};*/
+};
+
+// MappingUnion gives the same results as Mapping::update and Mapping::map
+// for mappings that are built by repeatedly merging one value into another,
+// as when merging nets. Mapping::update visits every entry to find those
+// that map to from. MappingUnion instead keeps the keys in disjoint sets,
+// one per value, so update merges two sets in near constant time using
+// union by rank, and map follows a path that is halved on every lookup.
+// Call flatten() to get the equivalent Mapping.
+//
+// In a reset mapping, update erases every entry that maps to undef. The
+// set holding them is marked dead rather than taken apart, and a key in a
+// dead set counts as absent. Adding such a key again gives it a new node.
+template <typename T>
+struct MappingUnion {
+	static constexpr size_t npos = (size_t)-1;
+
+	MappingUnion(T undef=T(), bool identity = true) {
+		this->undef = undef;
+		this->identity = identity;
+		undefGroup = npos;
+	}
+
+	MappingUnion(const Mapping<T> &m) : MappingUnion(m.undef, m.identity) {
+		for (auto i = m.fwd.begin(); i != m.fwd.end(); i++) {
+			add(i->first, i->second);
+		}
+	}
+
+	~MappingUnion() {
+	}
+
+	T undef;
+	bool identity;
+
+	// The node of each key, and the root node of the set for each value.
+	// The set for undef is kept apart, since a negative undef would push
+	// groups out of its dense representation.
+	typename MappingStore<T, size_t>::type keys;
+	typename MappingStore<T, size_t>::type groups;
+	size_t undefGroup;
+
+	mutable std::vector<size_t> parent;
+	std::vector<uint8_t> rank;
+	// The value of each set and whether it is alive, stored at its root
+	std::vector<T> value;
+	std::vector<bool> alive;
+
+	size_t find(size_t node) const {
+		while (parent[node] != node) {
+			parent[node] = parent[parent[node]];
+			node = parent[node];
+		}
+		return node;
+	}
+
+	size_t groupOf(T to) const {
+		if (to == undef) {
+			return undefGroup;
+		}
+		auto pos = groups.find(to);
+		return pos != groups.end() ? pos->second : npos;
+	}
+
+	void setGroup(T to, size_t root) {
+		if (to == undef) {
+			undefGroup = root;
+		} else {
+			groups[to] = root;
+		}
+	}
+
+	void eraseGroup(T to) {
+		if (to == undef) {
+			undefGroup = npos;
+		} else {
+			groups.erase(to);
+		}
+	}
+
+	size_t makeNode(size_t root) {
+		size_t node = parent.size();
+		parent.push_back(root == npos ? node : root);
+		rank.push_back(0);
+		value.push_back(T());
+		alive.push_back(true);
+		return node;
+	}
+
+	// Put from in the set for to, which is created if needed
+	void add(T from, T to) {
+		size_t root = groupOf(to);
+		size_t node = makeNode(root);
+		if (root == npos) {
+			value[node] = to;
+			setGroup(to, node);
+		} else if (rank[root] == 0) {
+			rank[root] = 1;
+		}
+		keys[from] = node;
+	}
+
+	bool hasKey(T from) const {
+		auto pos = keys.find(from);
+		return pos != keys.end() and alive[find(pos->second)];
+	}
+
+	void update(T from, T to) {
+		size_t src = from != to ? groupOf(from) : npos;
+		if (src != npos) {
+			eraseGroup(from);
+			size_t dst = groupOf(to);
+			if (dst != npos) {
+				if (rank[src] > rank[dst]) {
+					std::swap(src, dst);
+				} else if (rank[src] == rank[dst]) {
+					rank[dst]++;
+				}
+				parent[src] = dst;
+				src = dst;
+			}
+			value[src] = to;
+			setGroup(to, src);
+		}
+
+		if (not identity and undefGroup != npos) {
+			alive[undefGroup] = false;
+			undefGroup = npos;
+		}
+
+		if (not hasKey(from)) {
+			add(from, to);
+		}
+	}
+
+	T map(T from) const {
+		auto pos = keys.find(from);
+		if (pos != keys.end()) {
+			size_t root = find(pos->second);
+			if (alive[root]) {
+				return value[root];
+			}
+		}
+		return identity ? from : undef;
+	}
+
+	T operator[](T from) const {
+		return map(from);
+	}
+
+	Mapping<T> flatten() const {
+		Mapping<T> result(undef, identity);
+		for (auto i = keys.begin(); i != keys.end(); i++) {
+			size_t root = find(i->second);
+			if (alive[root]) {
+				result.fwd.insert({i->first, value[root]});
+			}
+		}
+		return result;
+	}
+};
+
+// Permutation is a bijection on the ids [0, size()) stored as a flat array,
+// where to[i] is the image of i. Unlike a Mapping it can be inverted and
+// composed in a single pass, and it can reorder arrays of data in place,
+// following each cycle with one swap per element and no scratch copy.
+//
+// Permutation<int> p({1, 2, 0});
+// std::vector<char> a = {'a', 'b', 'c'};
+// std::vector<int> b = {10, 11, 12};
+// p.apply(a, b);   // a = {'c', 'a', 'b'}, b = {12, 10, 11}
+template <typename T>
+struct Permutation {
+	static_assert(std::is_integral<T>::value, "Permutation requires an integral id");
+
+	Permutation(size_t n = 0) {
+		to.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			to[i] = T(i);
+		}
+	}
+
+	Permutation(std::vector<T> to) {
+		this->to = std::move(to);
+		if (not isValid()) {
+			internal("", "permutation is not a bijection", __FILE__, __LINE__);
+		}
+	}
+
+	// Take the restriction of m to [0, n), which must be a bijection onto
+	// [0, n).
+	Permutation(const Mapping<T> &m, size_t n) {
+		to.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			// Look the id up directly, since undef may itself be in range
+			auto pos = m.fwd.find(T(i));
+			bool mapped = pos != m.fwd.end() or m.identity;
+			to[i] = pos != m.fwd.end() ? pos->second : T(i);
+			if (not mapped or to[i] < T(0) or (size_t)to[i] >= n) {
+				internal("", "mapping does not send " + std::to_string(i) + " into [0, " + std::to_string(n) + ")", __FILE__, __LINE__);
+				return;
+			}
+		}
+		if (not isValid()) {
+			internal("", "mapping is not a permutation", __FILE__, __LINE__);
+		}
+	}
+
+	~Permutation() {
+	}
+
+	std::vector<T> to;
+
+	bool isValid() const {
+		std::vector<bool> seen(to.size(), false);
+		for (auto i = to.begin(); i != to.end(); i++) {
+			if (*i < T(0) or (size_t)*i >= to.size() or seen[(size_t)*i]) {
+				return false;
+			}
+			seen[(size_t)*i] = true;
+		}
+		return true;
+	}
+
+	size_t size() const {
+		return to.size();
+	}
+
+	T map(T from) const {
+		return to[(size_t)from];
+	}
+
+	T operator[](T from) const {
+		return to[(size_t)from];
+	}
+
+	bool isIdentity() const {
+		for (size_t i = 0; i < to.size(); i++) {
+			if (to[i] != T(i)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	Permutation inverse() const {
+		Permutation result;
+		result.to.resize(to.size());
+		for (size_t i = 0; i < to.size(); i++) {
+			result.to[(size_t)to[i]] = T(i);
+		}
+		return result;
+	}
+
+	// Compose with p, so that the result maps x to p.map(this->map(x)).
+	// The shorter of the two is extended with fixed points.
+	Permutation<T> &operator*=(const Permutation<T> &p) {
+		for (size_t i = to.size(); i < p.to.size(); i++) {
+			to.push_back(T(i));
+		}
+		for (size_t i = 0; i < to.size(); i++) {
+			if ((size_t)to[i] < p.to.size()) {
+				to[i] = p.to[(size_t)to[i]];
+			}
+		}
+		return *this;
+	}
+
+	// Every cycle of length two or more, each starting from its smallest id
+	std::vector<std::vector<T> > cycles() const {
+		std::vector<std::vector<T> > result;
+		std::vector<bool> seen(to.size(), false);
+		for (size_t i = 0; i < to.size(); i++) {
+			if (seen[i] or to[i] == T(i)) {
+				continue;
+			}
+			result.push_back(std::vector<T>());
+			for (size_t j = i; not seen[j]; j = (size_t)to[j]) {
+				seen[j] = true;
+				result.back().push_back(T(j));
+			}
+		}
+		return result;
+	}
+
+	// Move the element at index i of every array to index to[i]. All of the
+	// arrays are reordered together in one walk over the cycles.
+	template <typename... Arrays>
+	void apply(Arrays&... arrays) const {
+		std::vector<uint64_t> seen((to.size()+63)/64, 0);
+		for (size_t i = 0; i < to.size(); i++) {
+			if ((seen[i>>6] >> (i&63)) & 1) {
+				continue;
+			}
+			seen[i>>6] |= (uint64_t)1 << (i&63);
+			for (size_t j = (size_t)to[i]; j != i; j = (size_t)to[j]) {
+				(std::swap(arrays[i], arrays[j]), ...);
+				seen[j>>6] |= (uint64_t)1 << (j&63);
+			}
+		}
+	}
+
+	// Fixed points are left out, since an identity Mapping covers them
+	Mapping<T> toMapping(T undef=T()) const {
+		Mapping<T> result(undef, true);
+		for (size_t i = 0; i < to.size(); i++) {
+			if (to[i] != T(i)) {
+				result.fwd.insert({T(i), to[i]});
+			}
+		}
+		return result;
+	}
+};
+
+template <typename T>
+Permutation<T> operator*(Permutation<T> p0, const Permutation<T> &p1) {
+	return p0 *= p1;
+}
@@ -1,12 +1,21 @@
 #include "mock_netlist.h"
 
-int MockNetlist::netIndex(string name) const {
-	int region = 0;
+#include <charconv>
+
+// Split a trailing 'region off of a net name
+static string_view splitRegion(string_view name, int &region) {
+	region = 0;
 	size_t tic = name.rfind('\'');
-	if (tic != string::npos) {
-		region = std::stoi(name.substr(tic+1));
+	if (tic != string_view::npos) {
+		std::from_chars(name.data()+tic+1, name.data()+name.size(), region);
 		name = name.substr(0, tic);
 	}
+	return name;
+}
+
+int MockNetlist::netIndex(string_view name) const {
+	int region = 0;
+	name = splitRegion(name, region);
 
 	for (int i = 0; i < (int)nets.size(); i++) {
 		if (nets[i].first == name and nets[i].second == region) {
@@ -16,13 +25,9 @@ int MockNetlist::netIndex(string name) const {
 	return -1;
 }
 
-int MockNetlist::netIndex(string name, bool define) {
+int MockNetlist::netIndex(string_view name, bool define) {
 	int region = 0;
-	size_t tic = name.rfind('\'');
-	if (tic != string::npos) {
-		region = std::stoi(name.substr(tic+1));
-		name = name.substr(0, tic);
-	}
+	name = splitRegion(name, region);
 
 	bool found = false;
 	for (int i = 0; i < (int)nets.size(); i++) {
@@ -35,12 +40,28 @@ int MockNetlist::netIndex(string name, bool define) {
 	}
 
 	if (found or define) {
-		nets.push_back({name, region});
+		nets.push_back({string(name), region});
 		return (int)nets.size()-1;
 	}
 	return -1;
 }
 
+int MockNetlist::netIndex(string name) const {
+	return netIndex(string_view(name));
+}
+
+int MockNetlist::netIndex(string name, bool define) {
+	return netIndex(string_view(name), define);
+}
+
+int MockNetlist::netIndex(const char *name) const {
+	return netIndex(string_view(name));
+}
+
+int MockNetlist::netIndex(const char *name, bool define) {
+	return netIndex(string_view(name), define);
+}
+
 string MockNetlist::netAt(int uid) const {
 	if (uid >= 0 && uid < (int)nets.size()) {
 		return nets[uid].first + (nets[uid].second != 0 ?
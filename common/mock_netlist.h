@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <map>
 #include <utility>
 
@@ -10,8 +11,15 @@ using namespace std;
 struct MockNetlist {
 	vector<pair<string, int> > nets;
 	
+	// The string overloads satisfy the ConstNetlist and Netlist
+	// interfaces. The others let callers look up a name without building a
+	// string for it.
+	int netIndex(string_view name) const;
+	int netIndex(string_view name, bool define);
 	int netIndex(string name) const;
 	int netIndex(string name, bool define);
+	int netIndex(const char *name) const;
+	int netIndex(const char *name, bool define);
 	string netAt(int uid) const;
 	int netCount() const;
 	void clear();
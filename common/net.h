@@ -85,4 +85,3 @@ _INTERFACE_ARG(SymbolTable,
 )
 
 }
-
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "net.h"
+#include "hash.h"
+
+// hash_traits for net names. These live apart from net.h so that netlist
+// code which never hashes a net does not pull in hash.h.
+HASH_MEMBERS(ucs::Field, name, slice)
+HASH_MEMBERS(ucs::Net, fields, region)
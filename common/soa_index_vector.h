@@ -0,0 +1,219 @@
+#pragma once
+
+#include <vector>
+#include <tuple>
+#include <bit>
+#include <utility>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include "index_vector.h"
+
+// soa_index_vector is an index_vector whose elements are split into their
+// fields, each stored in its own contiguous column. Slots are allocated,
+// freed and validated exactly as in index_vector. A pass that only reads
+// one or two fields then streams only those columns through the cache.
+//
+// soa_index_vector<int, float, std::string> v;
+// size_t i = v.emplace(1, 2.0f, "a");
+// v.get<1>(i) += 1.0f;
+// float total = 0;
+// v.for_each<1>([&](float f) { total += f; });
+template<typename... Fields>
+struct soa_index_vector {
+	using size_type = std::size_t;
+	using value_type = std::tuple<Fields...>;
+	using reference = std::tuple<Fields&...>;
+	using const_reference = std::tuple<const Fields&...>;
+
+	template<size_type I>
+	using field_type = std::tuple_element_t<I, value_type>;
+
+	std::tuple<std::vector<Fields>...> columns;
+	// which slots hold a live element
+	index_bitset live;
+
+	soa_index_vector() = default;
+
+	template<size_type I>
+	std::vector<field_type<I> > &column() {
+		return std::get<I>(columns);
+	}
+
+	template<size_type I>
+	const std::vector<field_type<I> > &column() const {
+		return std::get<I>(columns);
+	}
+
+	// Add a new element, reusing the lowest free index if possible
+	template<typename... Args>
+	size_type emplace(Args&&... args) {
+		static_assert(sizeof...(Args) == sizeof...(Fields), "soa_index_vector::emplace() takes one value per field");
+		size_type i = live.first_free();
+		if (i < size()) {
+			assign(i, std::forward<Args>(args)...);
+		} else {
+			push_back(std::index_sequence_for<Fields...>(), std::forward<Args>(args)...);
+			live.push_back(false);
+		}
+		live.set(i);
+		return i;
+	}
+
+	// The index the next call to emplace() will use
+	size_type next_index() const {
+		return live.first_free();
+	}
+
+	template<typename... Args>
+	void emplace_at(size_type i, Args&&... args) {
+		static_assert(sizeof...(Args) == sizeof...(Fields), "soa_index_vector::emplace_at() takes one value per field");
+		if (i >= size()) {
+			std::apply([&](auto&... column) { (column.resize(i + 1), ...); }, columns);
+			live.resize(i + 1);
+		}
+		assign(i, std::forward<Args>(args)...);
+		live.set(i);
+	}
+
+	size_type insert(const value_type &value) {
+		return std::apply([&](const Fields&... fields) { return emplace(fields...); }, value);
+	}
+
+	bool erase(size_type i) {
+		if (is_valid(i)) {
+			live.reset(i);
+			return true;
+		}
+		return false;
+	}
+
+	bool is_valid(size_type i) const {
+		return live.test(i);
+	}
+
+	template<size_type I>
+	field_type<I> &get(size_type i) {
+		if (not is_valid(i)) throw std::out_of_range("soa_index_vector::get() invalid index");
+		return std::get<I>(columns)[i];
+	}
+
+	template<size_type I>
+	const field_type<I> &get(size_type i) const {
+		if (not is_valid(i)) throw std::out_of_range("soa_index_vector::get() invalid index");
+		return std::get<I>(columns)[i];
+	}
+
+	// Every field of the element at index i
+	reference at(size_type i) {
+		if (not is_valid(i)) throw std::out_of_range("soa_index_vector::at() invalid index");
+		return std::apply([&](auto&... column) { return reference(column[i]...); }, columns);
+	}
+
+	const_reference at(size_type i) const {
+		if (not is_valid(i)) throw std::out_of_range("soa_index_vector::at() invalid index");
+		return std::apply([&](const auto&... column) { return const_reference(column[i]...); }, columns);
+	}
+
+	reference operator[](size_type i) {
+		return at(i);
+	}
+
+	const_reference operator[](size_type i) const {
+		return at(i);
+	}
+
+	size_type size() const {
+		return live.size();
+	}
+
+	size_type count() const {
+		return live.count();
+	}
+
+	void clear() {
+		std::apply([](auto&... column) { (column.clear(), ...); }, columns);
+		live.clear();
+	}
+
+	// Call f(index, field...) for the requested fields of every live element,
+	// in order of index. Words of the bitset with every slot live are handed
+	// to f as a plain run of 64 indices so the loop can be vectorized.
+	template<size_type... Is, typename F>
+	void for_each_indexed(F f) {
+		visit<Is...>(*this, f);
+	}
+
+	template<size_type... Is, typename F>
+	void for_each_indexed(F f) const {
+		visit<Is...>(*this, f);
+	}
+
+	// Call f(field...) for the requested fields of every live element
+	template<size_type... Is, typename F>
+	void for_each(F f) {
+		visit<Is...>(*this, [&](size_type, auto&... fields) { f(fields...); });
+	}
+
+	template<size_type... Is, typename F>
+	void for_each(F f) const {
+		visit<Is...>(*this, [&](size_type, const auto&... fields) { f(fields...); });
+	}
+
+	// Move the live elements down to the front and return the mapping from
+	// old indices to new ones, the same as index_vector::compact()
+	Mapping<size_type> compact() {
+		Mapping<size_type> result(size_type(-1), false);
+
+		size_type n = 0;
+		for (size_type i = 0; i < size(); ++i) {
+			if (live.test(i)) {
+				if (i != n) {
+					std::apply([&](auto&... column) { ((column[n] = std::move(column[i])), ...); }, columns);
+				}
+				result.fwd.insert({i, n++});
+			} else {
+				result.fwd.insert({i, size_type(-1)});
+			}
+		}
+
+		std::apply([&](auto&... column) { (column.erase(column.begin() + n, column.end()), ...); }, columns);
+		live.fill(n);
+		return result;
+	}
+
+	template<size_type... Is, typename Self, typename F>
+	static void visit(Self &self, F &&f) {
+		auto &words = self.live.words;
+		for (size_type w = 0; w < words.size(); w++) {
+			uint64_t bits = words[w];
+			size_type base = w<<6;
+			if (bits == ~uint64_t(0)) {
+				for (size_type i = base; i < base + 64; i++) {
+					f(i, std::get<Is>(self.columns)[i]...);
+				}
+			} else {
+				while (bits != 0) {
+					size_type i = base + std::countr_zero(bits);
+					f(i, std::get<Is>(self.columns)[i]...);
+					bits &= bits - 1;
+				}
+			}
+		}
+	}
+
+	template<size_type... Is, typename... Args>
+	void push_back(std::index_sequence<Is...>, Args&&... args) {
+		(std::get<Is>(columns).emplace_back(std::forward<Args>(args)), ...);
+	}
+
+	template<typename... Args>
+	void assign(size_type i, Args&&... args) {
+		assign(std::index_sequence_for<Fields...>(), i, std::forward<Args>(args)...);
+	}
+
+	template<size_type... Is, typename... Args>
+	void assign(std::index_sequence<Is...>, size_type i, Args&&... args) {
+		((std::get<Is>(columns)[i] = field_type<Is>(std::forward<Args>(args))), ...);
+	}
+};
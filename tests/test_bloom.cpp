@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <common/bloom.h>
+#include <common/timer.h>
+
+TEST(BloomFilterTest, NoFalseNegatives) {
+	bloom_filter filter(10000, 10);
+	for (int i = 0; i < 10000; i++) {
+		filter.insert(i*7);
+	}
+	for (int i = 0; i < 10000; i++) {
+		EXPECT_TRUE(filter.may_contain(i*7));
+	}
+}
+
+TEST(BloomFilterTest, FalsePositiveRate) {
+	const int num_keys = 100000;
+	bloom_filter filter(num_keys, 10);
+	for (int i = 0; i < num_keys; i++) {
+		filter.insert(i);
+	}
+
+	int false_positives = 0;
+	for (int i = num_keys; i < 2*num_keys; i++) {
+		false_positives += filter.may_contain(i);
+	}
+	// An unblocked filter at 10 bits per key gives about 0.8%, blocking
+	// costs a little on top of that.
+	EXPECT_LT(false_positives, num_keys*2/100);
+	EXPECT_EQ(filter.bytes(), (size_t)((num_keys*10 + 511)/512)*64);
+}
+
+TEST(BloomFilterTest, Strings) {
+	bloom_filter filter(100);
+	filter.insert(string("alpha"));
+	EXPECT_TRUE(filter.may_contain(string("alpha")));
+	EXPECT_TRUE(filter.may_contain(std::string_view("alpha")));
+	filter.clear();
+	EXPECT_FALSE(filter.may_contain(string("alpha")));
+}
+
+TEST(CountingBloomFilterTest, InsertErase) {
+	const int num_keys = 20000;
+	counting_bloom_filter filter(num_keys, 12);
+	for (int i = 0; i < num_keys; i++) {
+		filter.insert(i);
+	}
+	for (int i = 0; i < num_keys; i += 2) {
+		filter.erase(i);
+	}
+
+	int kept = 0, erased = 0;
+	for (int i = 0; i < num_keys; i++) {
+		if (i%2 == 1) {
+			kept += filter.may_contain(i);
+		} else {
+			erased += filter.may_contain(i);
+		}
+	}
+	EXPECT_EQ(kept, num_keys/2);
+	EXPECT_LT(erased, num_keys/2/20);
+}
+
+TEST(HashBenchmark, DISABLED_BloomFilterInFrontOfMisses) {
+	const int num_keys = 1000000;
+	flat_hashmap<long long, int> table;
+	bloom_filter filter(num_keys, 10);
+	for (int i = 0; i < num_keys; i++) {
+		table.insert((long long)i*3, i);
+		filter.insert((long long)i*3);
+	}
+
+	// Nine in ten lookups miss
+	Timer timer;
+	int found = 0;
+	for (long long i = 0; i < 10*num_keys; i++) {
+		found += table.contains(i*3 + (i%10 != 0));
+	}
+	float plain_time = timer.since();
+
+	timer.reset();
+	int filtered = 0;
+	for (long long i = 0; i < 10*num_keys; i++) {
+		long long key = i*3 + (i%10 != 0);
+		uint64_t hash = hasher(&key).get64();
+		size_t index;
+		filtered += filter.may_contain_hash(hash) and table.find_slot(key, hash, index);
+	}
+	float filtered_time = timer.since();
+
+	EXPECT_EQ(found, filtered);
+	cout << "flat_hashmap alone:    " << plain_time << "s" << endl;
+	cout << "bloom filter in front: " << filtered_time << "s" << endl;
+}
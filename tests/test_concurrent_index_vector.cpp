@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include <common/concurrent_index_vector.h>
+#include <common/timer.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
+TEST(ConcurrentIndexVectorTest, SingleThread) {
+	concurrent_index_vector<std::string> v;
+	for (int i = 0; i < 300; i++) {
+		EXPECT_EQ(v.emplace(std::to_string(i)), (size_t)i);
+	}
+	EXPECT_TRUE(v.erase(10));
+	EXPECT_FALSE(v.erase(10));
+	EXPECT_FALSE(v.erase(1000));
+	EXPECT_FALSE(v.is_valid(10));
+	EXPECT_THROW(v.at(10), std::out_of_range);
+	EXPECT_EQ(v.count(), 299u);
+
+	EXPECT_EQ(v.emplace("again"), 10u);
+	EXPECT_EQ(v[10], "again");
+	EXPECT_EQ(v.count(), 300u);
+
+	for (int i = 0; i < 300; i++) {
+		if (i%50 != 0) {
+			v.erase(i);
+		}
+	}
+	std::vector<std::string> live;
+	for (auto i = v.begin(); i != v.end(); i++) {
+		live.push_back(*i);
+	}
+	EXPECT_EQ(live, (std::vector<std::string>{"0", "50", "100", "150", "200", "250"}));
+
+	v.clear();
+	EXPECT_EQ(v.count(), 0u);
+	EXPECT_EQ(v.emplace("x"), 0u);
+}
+
+namespace {
+
+// Has no default constructor, counts live objects, and throws when asked to
+struct counted {
+	static int alive;
+
+	counted(int value) : value(value) {
+		if (value < 0) {
+			throw std::runtime_error("counted");
+		}
+		alive++;
+	}
+	counted(const counted &other) : value(other.value) { alive++; }
+	~counted() { alive--; }
+
+	int value;
+};
+
+int counted::alive = 0;
+
+}
+
+// Slots are raw memory, so only emplaced elements are ever constructed
+TEST(ConcurrentIndexVectorTest, LazyConstruction) {
+	{
+		concurrent_index_vector<counted> v;
+		for (int i = 0; i < 100; i++) {
+			v.emplace(i);
+		}
+		EXPECT_EQ(counted::alive, 100);
+		v.erase(5);
+		EXPECT_EQ(counted::alive, 99);
+
+		// A throwing constructor gives its slot back
+		EXPECT_THROW(v.emplace(-1), std::runtime_error);
+		EXPECT_EQ(v.count(), 99u);
+		EXPECT_EQ(counted::alive, 99);
+		EXPECT_EQ(v.emplace(7), 5u);
+		EXPECT_THROW(v.emplace(-1), std::runtime_error);
+		EXPECT_EQ(v.emplace(8), 100u);
+		EXPECT_EQ(v.count(), 101u);
+		EXPECT_EQ(v[100].value, 8);
+	}
+	EXPECT_EQ(counted::alive, 0);
+}
+
+TEST(ConcurrentIndexVectorTest, ParallelEmplaceErase) {
+	const int num_threads = 4;
+	const int per_thread = 20000;
+	concurrent_index_vector<int> v;
+	std::vector<std::vector<size_t> > kept(num_threads);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.push_back(std::thread([&, t]() {
+			std::vector<size_t> mine;
+			for (int i = 0; i < per_thread; i++) {
+				mine.push_back(v.emplace(t*per_thread + i));
+				// Free every other slot straight away so that later emplaces
+				// race to reuse them
+				if (i%2 == 1) {
+					EXPECT_TRUE(v.erase(mine.back()));
+					mine.pop_back();
+				}
+			}
+			kept[t] = mine;
+		}));
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	std::vector<size_t> all;
+	for (int t = 0; t < num_threads; t++) {
+		for (size_t i : kept[t]) {
+			EXPECT_TRUE(v.is_valid(i));
+			EXPECT_EQ(v[i]/per_thread, t);
+			all.push_back(i);
+		}
+	}
+	std::sort(all.begin(), all.end());
+	EXPECT_EQ(std::unique(all.begin(), all.end()), all.end());
+	EXPECT_EQ(v.count(), all.size());
+	EXPECT_EQ((size_t)std::distance(v.begin(), v.end()), all.size());
+	EXPECT_LE(v.size(), all.size() + num_threads);
+}
+
+TEST(IndexVectorBenchmark, DISABLED_ConcurrentThroughput) {
+	const int ops = 4000000;
+	for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+		concurrent_index_vector<int> v;
+		Timer timer;
+		std::vector<std::thread> threads;
+		for (int t = 0; t < num_threads; t++) {
+			threads.push_back(std::thread([&]() {
+				std::vector<size_t> mine;
+				mine.reserve(64);
+				for (int i = 0; i < ops/num_threads; i++) {
+					mine.push_back(v.emplace(i));
+					if (mine.size() == 64) {
+						for (size_t j = 0; j < mine.size(); j += 2) {
+							v.erase(mine[j]);
+						}
+						mine.clear();
+					}
+				}
+			}));
+		}
+		for (auto &thread : threads) {
+			thread.join();
+		}
+		float elapsed = timer.since();
+		std::cout << num_threads << " threads " << ops/elapsed/1e6 << "M emplace/s (" << v.count() << " live of " << v.size() << ")" << std::endl;
+	}
+}
@@ -0,0 +1,880 @@
+#include <gtest/gtest.h>
+#include <common/hash.h>
+#include <common/net_hash.h>
+#include <common/mock_netlist.h>
+#include <common/timer.h>
+#include <vector>
+#include <string>
+#include <set>
+#include <thread>
+#include <atomic>
+
+// The digest must depend only on the byte stream, not on how it was split
+// across calls to put() or write().
+TEST(HasherTest, StreamingIsSplitInvariant) {
+	vector<int> values;
+	for (int i = 0; i < 37; i++) {
+		values.push_back(i*7919);
+	}
+
+	uint64_t whole = hasher(values.data(), (int)values.size()).get64();
+	for (int split = 0; split <= (int)values.size(); split++) {
+		hasher h;
+		h.put(values.data(), split);
+		h.put(values.data()+split, (int)values.size()-split);
+		EXPECT_EQ(h.get64(), whole);
+	}
+
+	string text = "the quick brown fox jumps over the lazy dog";
+	hasher h0;
+	h0.write(text.data(), text.size());
+	uint64_t expect = h0.get64();
+	for (int split = 0; split <= (int)text.size(); split++) {
+		hasher h;
+		h.write(text.data(), split);
+		h.write(text.data() + split, text.size() - split);
+		EXPECT_EQ(h.get64(), expect);
+	}
+
+	// put() delimits a string with its length, so it does not split
+	hasher h1;
+	h1.put(text.substr(0, 3));
+	h1.put(text.substr(3));
+	h0.put(text);
+	EXPECT_NE(h1.get64(), h0.get64());
+}
+
+TEST(HasherTest, GetResets) {
+	int value = 42;
+	hasher h(&value);
+	uint64_t first = h.get64();
+	h.put(&value);
+	EXPECT_EQ(h.get64(), first);
+	EXPECT_EQ(hasher(&value).get(), (uint32_t)(first ^ (first >> 32)));
+}
+
+TEST(HasherTest, Distribution) {
+	std::set<uint64_t> digests;
+	std::set<uint32_t> low;
+	for (int i = 0; i < 100000; i++) {
+		uint64_t hash = hasher(&i).get64();
+		digests.insert(hash);
+		low.insert((uint32_t)(hash & 0xFFFF));
+	}
+	EXPECT_EQ(digests.size(), 100000u);
+	// 100000 keys over 65536 low-bit buckets should hit almost all of them
+	EXPECT_GT(low.size(), 50000u);
+
+	// Keys that differ only in length must not collide
+	char zeros[16] = {0};
+	std::set<uint64_t> lengths;
+	for (int n = 0; n <= 16; n++) {
+		lengths.insert(hasher(zeros, n).get64());
+	}
+	EXPECT_EQ(lengths.size(), 17u);
+}
+
+TEST(HashBenchmark, DISABLED_StreamingVsBuffered) {
+	const int num_keys = 1000000;
+	vector<vector<int> > keys(num_keys);
+	for (int i = 0; i < num_keys; i++) {
+		for (int j = 0; j < 1 + i%8; j++) {
+			keys[i].push_back(i*31 + j);
+		}
+	}
+
+	// The previous path: copy every byte into a heap buffer, then hash it
+	Timer timer;
+	uint32_t buffered = 0;
+	for (int i = 0; i < num_keys; i++) {
+		vector<char> data;
+		const char *ptr = (const char *)keys[i].data();
+		for (int j = 0; j < (int)(keys[i].size()*sizeof(int)); j++) {
+			data.push_back(ptr[j]);
+		}
+		buffered ^= superfasthash(data.data(), data.size());
+	}
+	float buffered_time = timer.since();
+
+	timer.reset();
+	uint64_t streamed = 0;
+	for (int i = 0; i < num_keys; i++) {
+		streamed ^= hasher(&keys[i]).get64();
+	}
+	float streamed_time = timer.since();
+
+	cout << "buffered superfasthash: " << buffered_time << "s (" << buffered << ")" << endl;
+	cout << "streaming hasher:       " << streamed_time << "s (" << streamed << ")" << endl;
+}
+
+TEST(FlatHashmapTest, InsertFindErase) {
+	flat_hashmap<int, int> m;
+	for (int i = 0; i < 1000; i++) {
+		EXPECT_TRUE(m.insert(i, i*2));
+	}
+	EXPECT_FALSE(m.insert(5, 0));
+	EXPECT_EQ(m.size(), 1000u);
+
+	flat_hashmap<int, int>::iterator loc;
+	ASSERT_TRUE(m.find(5, &loc));
+	EXPECT_EQ(loc->first, 5);
+	EXPECT_EQ(loc->second, 10);
+	EXPECT_FALSE(m.find(1000, &loc));
+	EXPECT_EQ(loc, m.end());
+
+	for (int i = 0; i < 1000; i += 2) {
+		ASSERT_TRUE(m.find(i, &loc));
+		m.erase(loc);
+	}
+	EXPECT_EQ(m.size(), 500u);
+	for (int i = 0; i < 1000; i++) {
+		EXPECT_EQ(m.contains(i), i%2 == 1);
+	}
+
+	int visited = 0;
+	for (auto i = m.begin(); i != m.end(); i++) {
+		EXPECT_EQ(i->second, i->first*2);
+		visited++;
+	}
+	EXPECT_EQ(visited, 500);
+}
+
+TEST(FlatHashmapTest, MatchesStdMap) {
+	flat_hashmap<int, int> m;
+	std::map<int, int> expect;
+	unsigned int seed = 1;
+	for (int i = 0; i < 200000; i++) {
+		seed = seed*1103515245u + 12345u;
+		int key = (seed >> 8)%5000;
+		if ((seed >> 4)%3 == 0) {
+			EXPECT_EQ(m.erase(key), expect.erase(key) > 0);
+		} else {
+			m[key] = i;
+			expect[key] = i;
+		}
+	}
+
+	EXPECT_EQ(m.size(), expect.size());
+	for (auto i = expect.begin(); i != expect.end(); i++) {
+		flat_hashmap<int, int>::const_iterator loc;
+		ASSERT_TRUE(((const flat_hashmap<int, int> &)m).find(i->first, &loc));
+		EXPECT_EQ(loc->second, i->second);
+	}
+}
+
+TEST(FlatHashmapTest, Reserve) {
+	flat_hashmap<long long, int> m;
+	m.reserve(1000);
+	size_t capacity = m.capacity();
+	EXPECT_GE((size_t)(capacity*m.max_load), 1000u);
+	for (int i = 0; i < 1000; i++) {
+		m.insert(i, i);
+	}
+	EXPECT_EQ(m.capacity(), capacity);
+	EXPECT_EQ(m[17], 17);
+}
+
+TEST(HashBenchmark, DISABLED_FlatHashmapVsHashmap) {
+	const int num_keys = 1000000;
+	vector<int> keys(num_keys);
+	for (int i = 0; i < num_keys; i++) {
+		keys[i] = i*2654435761u;
+	}
+
+	Timer timer;
+	hashmap<int, int, 1024> *fixed = new hashmap<int, int, 1024>();
+	for (int i = 0; i < num_keys; i++) {
+		fixed->insert(keys[i], i);
+	}
+	float fixed_insert = timer.since();
+	timer.reset();
+	int fixed_found = 0;
+	for (int i = 0; i < 2*num_keys; i++) {
+		fixed_found += fixed->find(i*2654435761u);
+	}
+	float fixed_find = timer.since();
+	delete fixed;
+
+	timer.reset();
+	flat_hashmap<int, int> flat;
+	for (int i = 0; i < num_keys; i++) {
+		flat.insert(keys[i], i);
+	}
+	float flat_insert = timer.since();
+	timer.reset();
+	int flat_found = 0;
+	for (int i = 0; i < 2*num_keys; i++) {
+		flat_found += flat.find(i*2654435761u);
+	}
+	float flat_find = timer.since();
+
+	EXPECT_EQ(fixed_found, flat_found);
+	cout << "hashmap<1024>: insert " << fixed_insert << "s, find " << fixed_find << "s" << endl;
+	cout << "flat_hashmap:  insert " << flat_insert << "s, find " << flat_find << "s" << endl;
+}
+
+TEST(FlatHashsetTest, InsertContainsErase) {
+	flat_hashset<int> s;
+	for (int i = 0; i < 1000; i++) {
+		EXPECT_TRUE(s.insert(i*3));
+	}
+	EXPECT_FALSE(s.insert(3));
+	EXPECT_EQ(s.size(), 1000u);
+
+	flat_hashset<int>::iterator loc;
+	ASSERT_TRUE(s.contains(9, &loc));
+	EXPECT_EQ(*loc, 9);
+	EXPECT_FALSE(s.contains(10, &loc));
+	EXPECT_EQ(loc, s.end());
+
+	for (int i = 0; i < 1000; i += 2) {
+		EXPECT_TRUE(s.erase(i*3));
+	}
+	EXPECT_FALSE(s.erase(0));
+	EXPECT_EQ(s.size(), 500u);
+	for (int i = 0; i < 3000; i++) {
+		EXPECT_EQ(s.contains(i), i%6 == 3);
+	}
+
+	int visited = 0;
+	for (auto i = s.begin(); i != s.end(); i++) {
+		EXPECT_EQ(*i%6, 3);
+		visited++;
+	}
+	EXPECT_EQ(visited, 500);
+}
+
+TEST(FlatHashsetTest, MatchesStdSet) {
+	flat_hashset<uint64_t> s;
+	std::set<uint64_t> expect;
+	unsigned int seed = 7;
+	for (int i = 0; i < 200000; i++) {
+		seed = seed*1103515245u + 12345u;
+		uint64_t value = (seed >> 8)%3000;
+		if ((seed >> 4)%2 == 0) {
+			EXPECT_EQ(s.erase(value), expect.erase(value) > 0);
+		} else {
+			EXPECT_EQ(s.insert(value), expect.insert(value).second);
+		}
+	}
+
+	EXPECT_EQ(s.size(), expect.size());
+	for (uint64_t i = 0; i < 3000; i++) {
+		EXPECT_EQ(s.contains(i), expect.count(i) > 0);
+	}
+}
+
+TEST(HashtableTest, ContainsErase) {
+	hashtable<int, 16> t;
+	for (int i = 0; i < 100; i++) {
+		t.insert(i);
+	}
+	EXPECT_EQ(t.count, 100);
+	EXPECT_TRUE(t.contains(42));
+	t.erase(42);
+	t.erase(1000);
+	EXPECT_FALSE(t.contains(42));
+	EXPECT_EQ(t.count, 99);
+}
+
+TEST(HashBenchmark, DISABLED_FlatHashsetVsHashtable) {
+	const int num_keys = 1000000;
+	vector<int> keys(2*num_keys);
+	unsigned int seed = 3;
+	for (int i = 0; i < 2*num_keys; i++) {
+		seed = seed*1103515245u + 12345u;
+		keys[i] = (int)seed;
+	}
+
+	Timer timer;
+	hashtable<int, 1024> *fixed = new hashtable<int, 1024>();
+	for (int i = 0; i < num_keys; i++) {
+		fixed->insert(keys[i]);
+	}
+	float fixed_insert = timer.since();
+	timer.reset();
+	int fixed_found = 0;
+	for (int i = 0; i < 2*num_keys; i++) {
+		fixed_found += fixed->contains(keys[i]);
+	}
+	float fixed_find = timer.since();
+	delete fixed;
+
+	timer.reset();
+	flat_hashset<int> flat;
+	for (int i = 0; i < num_keys; i++) {
+		flat.insert(keys[i]);
+	}
+	float flat_insert = timer.since();
+	timer.reset();
+	int flat_found = 0;
+	for (int i = 0; i < 2*num_keys; i++) {
+		flat_found += flat.contains(keys[i]);
+	}
+	float flat_find = timer.since();
+
+	EXPECT_EQ(fixed_found, flat_found);
+	cout << "hashtable<1024>: insert " << fixed_insert << "s, contains " << fixed_find << "s" << endl;
+	cout << "flat_hashset:    insert " << flat_insert << "s, contains " << flat_find << "s" << endl;
+}
+
+TEST(ConcurrentHashmapTest, FindOrInsertOncePerKey) {
+	concurrent_hashmap<int, int> m;
+	std::atomic<int> next(0);
+	const int num_threads = 4;
+	const int num_keys = 20000;
+
+	vector<vector<int> > ids(num_threads, vector<int>(num_keys));
+	vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.push_back(std::thread([&, t]() {
+			for (int i = 0; i < num_keys; i++) {
+				int key = (i*7 + t*13)%num_keys;
+				ids[t][key] = m.find_or_insert(key, [&](const int &) { return next++; });
+			}
+		}));
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	// Every thread saw the same id for a key and each key was built once
+	EXPECT_EQ(next.load(), num_keys);
+	EXPECT_EQ(m.size(), (size_t)num_keys);
+	std::set<int> unique;
+	for (int i = 0; i < num_keys; i++) {
+		for (int t = 1; t < num_threads; t++) {
+			EXPECT_EQ(ids[t][i], ids[0][i]);
+		}
+		unique.insert(ids[0][i]);
+	}
+	EXPECT_EQ(unique.size(), (size_t)num_keys);
+
+	int value = -1;
+	EXPECT_TRUE(m.find(5, &value));
+	EXPECT_EQ(value, ids[0][5]);
+	EXPECT_TRUE(m.erase(5));
+	EXPECT_FALSE(m.find(5));
+	EXPECT_TRUE(m.insert(5, -1));
+	EXPECT_FALSE(m.insert(5, -2));
+
+	// Every entry is visited once with the id it was given
+	size_t visited = 0;
+	m.for_each([&](const int &key, const int &id) {
+		EXPECT_EQ(id, key == 5 ? -1 : ids[0][key]);
+		visited++;
+	});
+	EXPECT_EQ(visited, (size_t)num_keys);
+}
+
+TEST(HashBenchmark, DISABLED_ConcurrentHashmapScaling) {
+	const int num_ops = 2000000;
+	const int num_keys = 200000;
+	int max_threads = std::max(4, (int)std::thread::hardware_concurrency());
+
+	for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+		concurrent_hashmap<int, int> m;
+		std::atomic<int> next(0);
+		Timer timer;
+		vector<std::thread> threads;
+		for (int t = 0; t < num_threads; t++) {
+			threads.push_back(std::thread([&, t]() {
+				unsigned int seed = t+1;
+				for (int i = t; i < num_ops; i += num_threads) {
+					seed = seed*1103515245u + 12345u;
+					m.find_or_insert((int)((seed >> 8)%num_keys), [&](const int &) { return next++; });
+				}
+			}));
+		}
+		for (auto &thread : threads) {
+			thread.join();
+		}
+		float elapsed = timer.since();
+		cout << num_threads << " threads: " << elapsed << "s, " << (float)num_ops/elapsed/1e6 << "M ops/s" << endl;
+	}
+}
+
+TEST(HashconsTest, InternDeduplicates) {
+	hashcons<vector<int> > table;
+	vector<int> a = {1, 2, 3};
+	vector<int> b = {1, 2};
+	vector<int> c = {1, 2, 3};
+
+	int ia = table.intern(a);
+	int ib = table.intern(b);
+	EXPECT_EQ(ia, 0);
+	EXPECT_EQ(ib, 1);
+	EXPECT_EQ(table.intern(c), ia);
+	EXPECT_EQ(table.find(b), ib);
+	EXPECT_EQ(table.find(vector<int>{4}), -1);
+	EXPECT_EQ(table[ia], a);
+	EXPECT_EQ(table.size(), 2);
+
+	// Interned values must not move as the table grows
+	const vector<int> *pa = table.ptr(ia);
+	for (int i = 0; i < 10000; i++) {
+		table.intern(vector<int>{i, i+1});
+	}
+	EXPECT_EQ(pa, table.ptr(ia));
+	EXPECT_EQ(*pa, a);
+	EXPECT_EQ(table.intern(vector<int>{17, 18}), table.find(vector<int>{17, 18}));
+}
+
+TEST(HashconsTest, BulkIntern) {
+	hashcons<int> table;
+	vector<int> values;
+	for (int i = 0; i < 5000; i++) {
+		values.push_back(i%1000);
+	}
+
+	vector<int> ids = table.intern(values);
+	EXPECT_EQ(table.size(), 1000);
+	for (int i = 0; i < (int)values.size(); i++) {
+		EXPECT_EQ(ids[i], i%1000);
+		EXPECT_EQ(table[ids[i]], values[i]);
+	}
+}
+
+template <class type>
+static void expect_batch_matches_hasher(int n) {
+	vector<type> keys(n);
+	for (int i = 0; i < n; i++) {
+		keys[i] = (type)(i*37 + 11);
+	}
+	vector<uint64_t> hashes(n);
+	hash_batch(keys.data(), n, hashes.data());
+	for (int i = 0; i < n; i++) {
+		EXPECT_EQ(hashes[i], hasher(&keys[i]).get64());
+	}
+}
+
+TEST(HashBatchTest, MatchesHasher) {
+	for (int n = 0; n < 11; n++) {
+		expect_batch_matches_hasher<char>(n);
+		expect_batch_matches_hasher<short>(n);
+		expect_batch_matches_hasher<int>(n);
+		expect_batch_matches_hasher<long long>(n);
+		expect_batch_matches_hasher<double>(n);
+	}
+
+	// Keys wider than one word, with a partial tail
+	struct wide {
+		int values[5];
+	};
+	vector<wide> keys(9);
+	for (int i = 0; i < 9; i++) {
+		for (int j = 0; j < 5; j++) {
+			keys[i].values[j] = i*5 + j;
+		}
+	}
+	vector<uint64_t> hashes(keys.size());
+	hash_batch(keys.data(), keys.size(), hashes.data());
+	for (int i = 0; i < 9; i++) {
+		EXPECT_EQ(hashes[i], hasher(keys[i].values, 5).get64());
+	}
+
+	// Padding bytes would make the digest of equal keys differ, so
+	// hash_batch refuses them
+	struct padded {
+		char tag;
+		int value;
+	};
+	EXPECT_TRUE(hash_unpadded<wide>::value);
+	EXPECT_TRUE((hash_unpadded<std::array<double, 3> >::value));
+	EXPECT_FALSE(hash_unpadded<padded>::value);
+}
+
+TEST(HashBatchTest, BulkInsert) {
+	vector<pair<int, int> > entries;
+	vector<int> values;
+	for (int i = 0; i < 10000; i++) {
+		entries.push_back(pair<int, int>(i%5000, i));
+		values.push_back(i%3000);
+	}
+
+	flat_hashmap<int, int> m;
+	m.insert(entries);
+	EXPECT_EQ(m.size(), 5000u);
+	EXPECT_EQ(m[1234], 1234);
+
+	flat_hashset<int> s;
+	s.insert(values);
+	EXPECT_EQ(s.size(), 3000u);
+	EXPECT_TRUE(s.contains(2999));
+	EXPECT_FALSE(s.contains(3000));
+
+	// Inserting keys that are all present already does not grow the table
+	size_t map_capacity = m.capacity();
+	size_t set_capacity = s.capacity();
+	m.insert(entries);
+	s.insert(values);
+	EXPECT_EQ(m.capacity(), map_capacity);
+	EXPECT_EQ(s.capacity(), set_capacity);
+}
+
+TEST(HashBatchTest, RehashStringKeys) {
+	flat_hashmap<string, int> m;
+	flat_hashset<string> s;
+	for (int i = 0; i < 5000; i++) {
+		m.insert("net" + ::to_string(i), i);
+		s.insert("net" + ::to_string(i));
+	}
+	for (int i = 0; i < 5000; i += 3) {
+		m.erase("net" + ::to_string(i));
+		s.erase("net" + ::to_string(i));
+	}
+	m.rehash(m.capacity()*2);
+	s.rehash(s.capacity()*2);
+	for (int i = 0; i < 5000; i++) {
+		EXPECT_EQ(m.contains("net" + ::to_string(i)), i%3 != 0);
+		EXPECT_EQ(s.contains("net" + ::to_string(i)), i%3 != 0);
+	}
+	EXPECT_EQ(m.size(), 3333u);
+	EXPECT_EQ(s.size(), 3333u);
+}
+
+TEST(HashBenchmark, DISABLED_BatchVsScalar) {
+	const int num_keys = 10000000;
+	vector<long long> keys(num_keys);
+	for (int i = 0; i < num_keys; i++) {
+		keys[i] = (long long)i*2654435761ll;
+	}
+	vector<uint64_t> scalar(num_keys), batch(num_keys);
+
+	Timer timer;
+	for (int i = 0; i < num_keys; i++) {
+		scalar[i] = hasher(&keys[i]).get64();
+	}
+	float scalar_time = timer.since();
+
+	timer.reset();
+	hash_batch(keys.data(), num_keys, batch.data());
+	float batch_time = timer.since();
+
+	EXPECT_EQ(scalar, batch);
+	cout << "hasher per key: " << scalar_time << "s" << endl;
+	cout << "hash_batch:     " << batch_time << "s" << endl;
+}
+
+TEST(HashTraitsTest, ContiguousRangesHashAsBytes) {
+	vector<int> values = {1, 2, 3, 4, 5};
+	std::array<int, 5> fixed = {1, 2, 3, 4, 5};
+	hasher h;
+	for (int i = 0; i < 5; i++) {
+		h.write(&values[i], sizeof(int));
+	}
+	uint64_t expect = h.get64();
+	EXPECT_EQ(hasher(&fixed).get64(), expect);
+	EXPECT_EQ(hasher(values.data(), 5).get64(), expect);
+
+	// A vector is variable length, so its size goes first
+	h.put_length(values.size());
+	h.write(values.data(), values.size()*sizeof(int));
+	EXPECT_EQ(hasher(&values).get64(), h.get64());
+
+	// An empty vector has no data pointer, so only its size is hashed
+	vector<int> empty;
+	std::string_view nothing;
+	h.put_length(0);
+	uint64_t expect_empty = h.get64();
+	EXPECT_EQ(hasher(&empty).get64(), expect_empty);
+	EXPECT_EQ(hasher(&nothing).get64(), expect_empty);
+	EXPECT_TRUE(hash_traits<int>::bytes);
+	EXPECT_TRUE((hash_traits<std::array<short, 3> >::bytes));
+	EXPECT_FALSE(hash_traits<vector<int> >::bytes);
+}
+
+TEST(HashTraitsTest, Strings) {
+	string str = "ucs.net[3]";
+	std::string_view view = str;
+	hasher h;
+	h.put(str);
+	uint64_t expect = h.get64();
+	EXPECT_EQ(hasher(&str).get64(), expect);
+	EXPECT_EQ(hasher(&view).get64(), expect);
+	h.put(view);
+	EXPECT_EQ(h.get64(), expect);
+
+	// A char array is read up to its first null and never past its end
+	struct {
+		char name[4];
+		char after[4];
+	} unterminated = {{'n', 'e', 't', 's'}, {'x', 'y', 'z', 0}};
+	string nets = "nets";
+	EXPECT_EQ(hasher(&unterminated.name).get64(), hasher(&nets).get64());
+	char padded[8] = "net";
+	string net = "net";
+	EXPECT_EQ(hasher(&padded).get64(), hasher(&net).get64());
+}
+
+TEST(HashTraitsTest, Composites) {
+	pair<int, string> p(3, "abc");
+	std::tuple<int, string> t(3, "abc");
+	EXPECT_EQ(hasher(&p).get64(), hasher(&t).get64());
+
+	// Variable length members are delimited by their lengths
+	pair<string, string> split0("a", "bc");
+	pair<string, string> split1("ab", "c");
+	EXPECT_NE(hasher(&split0).get64(), hasher(&split1).get64());
+
+	vector<vector<int> > nested0 = {{1}, {2, 3}};
+	vector<vector<int> > nested1 = {{1, 2}, {3}};
+	EXPECT_NE(hasher(&nested0).get64(), hasher(&nested1).get64());
+
+	std::set<int> s0 = {1};
+	std::set<int> s1 = {2, 3};
+	pair<std::set<int>, std::set<int> > sets0(s0, s1);
+	pair<std::set<int>, std::set<int> > sets1(std::set<int>{1, 2}, std::set<int>{3});
+	EXPECT_NE(hasher(&sets0).get64(), hasher(&sets1).get64());
+
+	std::map<int, string> m0 = {{1, "ab"}, {2, ""}};
+	std::map<int, string> m1 = {{1, "a"}, {2, "b"}};
+	EXPECT_NE(hasher(&m0).get64(), hasher(&m1).get64());
+
+	// Without the lengths these would both hash as "a" followed by the
+	// bytes of the int 1
+	int one = 1;
+	ucs::Field f0("a", {one});
+	ucs::Field f1("a" + string((const char*)&one, sizeof(int)), {});
+	EXPECT_NE(hasher(&f0).get64(), hasher(&f1).get64());
+}
+
+TEST(HashTraitsTest, Nets) {
+	ucs::Net a("x.y[2].z'1");
+	ucs::Net b("x.y[2].z'1");
+	ucs::Net c("x.y[2].z");
+	EXPECT_EQ(hasher(&a).get64(), hasher(&b).get64());
+	EXPECT_NE(hasher(&a).get64(), hasher(&c).get64());
+
+	hashcons<ucs::Net> nets;
+	int id = nets.intern(a);
+	EXPECT_EQ(nets.intern(b), id);
+	EXPECT_NE(nets.intern(c), id);
+	EXPECT_EQ(nets.size(), 2);
+}
+
+TEST(HashStatsTest, BucketHistogram) {
+	hashtable<int, 16> table;
+	for (int i = 0; i < 100; i++) {
+		table.insert(i);
+	}
+
+	hash_stats stats = table.stats();
+	EXPECT_TRUE(stats.chained);
+	EXPECT_EQ(stats.size, 100u);
+	EXPECT_EQ(stats.capacity, 16u);
+	EXPECT_FLOAT_EQ(stats.load_factor(), 100.0f/16.0f);
+
+	size_t buckets = 0, entries = 0;
+	for (size_t i = 0; i < stats.histogram.size(); i++) {
+		buckets += stats.histogram[i];
+		entries += i*stats.histogram[i];
+	}
+	EXPECT_EQ(buckets, 16u);
+	EXPECT_EQ(entries, 100u);
+	EXPECT_EQ((int)stats.histogram.size()-1, table.max_bucket_size());
+}
+
+TEST(HashStatsTest, ProbeHistogram) {
+	flat_hashmap<int, int> map;
+	flat_hashset<int> set;
+	for (int i = 0; i < 1000; i++) {
+		map.insert(i, i);
+		set.insert(i);
+	}
+
+	hash_stats map_stats = map.stats();
+	hash_stats set_stats = set.stats();
+	EXPECT_FALSE(map_stats.chained);
+	EXPECT_EQ(map_stats.capacity, map.capacity());
+	EXPECT_EQ(map_stats.bytes, map.capacity()*(sizeof(pair<int, int>) + 1));
+	EXPECT_FLOAT_EQ(set_stats.load_factor(), set.load_factor());
+
+	size_t map_entries = 0, set_entries = 0;
+	for (size_t i = 0; i < map_stats.histogram.size(); i++) {
+		map_entries += map_stats.histogram[i];
+	}
+	for (size_t i = 0; i < set_stats.histogram.size(); i++) {
+		set_entries += set_stats.histogram[i];
+	}
+	EXPECT_EQ(map_entries, 1000u);
+	EXPECT_EQ(set_entries, 1000u);
+	EXPECT_GE(map_stats.average_probe(), 1.0f);
+	EXPECT_LT(map_stats.average_probe(), 4.0f);
+	EXPECT_LT(set_stats.average_probe(), 1.5f);
+}
+
+#ifndef HASH_STATS
+TEST(HashStatsTest, CompiledOutCostsNothing) {
+	EXPECT_TRUE(std::is_empty<hash_counters>::value);
+	EXPECT_EQ(sizeof(flat_hashset<int>), 2*sizeof(vector<int>) + 2*sizeof(size_t));
+}
+#endif
+
+TEST(PerfectHashTest, MinimalAndCollisionFree) {
+	vector<string> keys;
+	for (int i = 0; i < 100000; i++) {
+		keys.push_back("net_" + to_string(i));
+	}
+
+	perfect_hash table;
+	table.build(keys);
+	ASSERT_EQ(table.size(), keys.size());
+
+	vector<bool> used(keys.size(), false);
+	for (int i = 0; i < (int)keys.size(); i++) {
+		size_t index = table.find(keys[i]);
+		ASSERT_LT(index, keys.size());
+		EXPECT_FALSE(used[index]);
+		used[index] = true;
+	}
+
+	double bits_per_key = 8.0*(double)table.bytes()/(double)keys.size();
+	EXPECT_GT(bits_per_key, 2.0);
+	EXPECT_LT(bits_per_key, 4.0);
+}
+
+TEST(PerfectHashTest, DuplicatesAndEmpty) {
+	perfect_hash table;
+	vector<int> keys = {5, 3, 5, 9, 3};
+	table.build(keys);
+	EXPECT_EQ(table.size(), 3u);
+	set<size_t> indices = {table.find(3), table.find(5), table.find(9)};
+	EXPECT_EQ(indices, set<size_t>({0, 1, 2}));
+
+	table.build(vector<int>());
+	EXPECT_EQ(table.size(), 0u);
+	EXPECT_EQ(table.find(3), perfect_hash::npos);
+}
+
+TEST(PerfectHashTest, SaveLoad) {
+	vector<long long> keys;
+	for (long long i = 0; i < 10000; i++) {
+		keys.push_back(i*i);
+	}
+
+	perfect_hash table(2.0);
+	table.build(keys);
+	string path = testing::TempDir() + "/perfect_hash_test.bin";
+	ASSERT_TRUE(table.save(path));
+
+	perfect_hash loaded;
+	ASSERT_TRUE(loaded.load(path));
+	EXPECT_EQ(loaded.size(), table.size());
+	EXPECT_EQ(loaded.gamma, 2.0);
+	for (int i = 0; i < (int)keys.size(); i++) {
+		EXPECT_EQ(loaded(keys[i]), table(keys[i]));
+	}
+	remove(path.c_str());
+}
+
+TEST(HashBenchmark, DISABLED_PerfectHashVsFlatHashmap) {
+	const int num_keys = 1000000;
+	vector<string> keys;
+	for (int i = 0; i < num_keys; i++) {
+		keys.push_back("net_" + to_string((long long)i*7919));
+	}
+
+	Timer timer;
+	perfect_hash table;
+	table.build(keys);
+	float build_time = timer.since();
+
+	flat_hashmap<string, int> map;
+	for (int i = 0; i < num_keys; i++) {
+		map.insert(keys[i], i);
+	}
+
+	vector<uint64_t> hashes(num_keys);
+	for (int i = 0; i < num_keys; i++) {
+		hashes[i] = hasher(&keys[i]).get64();
+	}
+
+	timer.reset();
+	size_t total = 0;
+	for (int r = 0; r < 10; r++) {
+		for (int i = 0; i < num_keys; i++) {
+			total += table.find_hash(hashes[i]);
+		}
+	}
+	float perfect_time = timer.since();
+
+	timer.reset();
+	for (int r = 0; r < 10; r++) {
+		for (int i = 0; i < num_keys; i++) {
+			size_t index;
+			total += map.find_slot(keys[i], hashes[i], index);
+		}
+	}
+	float map_time = timer.since();
+
+	EXPECT_GT(total, 0u);
+	cout << "perfect_hash build:   " << build_time << "s, " << 8.0*table.bytes()/num_keys << " bits per key" << endl;
+	cout << "perfect_hash lookups: " << perfect_time << "s" << endl;
+	cout << "flat_hashmap lookups: " << map_time << "s, " << 8.0*map.stats().bytes/num_keys << " bits per key" << endl;
+}
+
+TEST(HeterogeneousLookupTest, FlatContainers) {
+	flat_hashmap<string, int> map;
+	flat_hashset<string> set;
+	map.insert("alpha", 1);
+	map.insert("beta", 2);
+	set.insert("alpha");
+
+	std::string_view view("alpha");
+	const char *cstr = "beta";
+	string key("alpha");
+	EXPECT_EQ(hasher(&view).get64(), hasher(&key).get64());
+	key = "beta";
+	EXPECT_EQ(hasher(&cstr).get64(), hasher(&key).get64());
+
+	flat_hashmap<string, int>::iterator loc;
+	EXPECT_TRUE(map.find(view, &loc));
+	EXPECT_EQ(loc->second, 1);
+	EXPECT_TRUE(map.contains(cstr));
+	EXPECT_TRUE(map.contains("beta"));
+	EXPECT_FALSE(map.contains(std::string_view("gamma")));
+	EXPECT_TRUE(set.contains(view));
+	EXPECT_FALSE(set.contains("beta"));
+
+	EXPECT_TRUE(map.erase(std::string_view("beta")));
+	EXPECT_FALSE(map.contains("beta"));
+	EXPECT_TRUE(set.erase("alpha"));
+	EXPECT_TRUE(set.empty());
+
+	// Keys that only convert to key_type still go through the key overload
+	flat_hashmap<long long, int> numbers;
+	numbers.insert(5, 1);
+	EXPECT_TRUE(numbers.contains(5));
+}
+
+TEST(HeterogeneousLookupTest, InternAndConcurrent) {
+	hashcons<string> names;
+	int id = names.intern(std::string_view("net_a"));
+	EXPECT_EQ(names.intern("net_a"), id);
+	EXPECT_EQ(names.intern(string("net_a")), id);
+	EXPECT_EQ(names.find(std::string_view("net_a")), id);
+	EXPECT_EQ(names.find("net_b"), -1);
+
+	concurrent_hashmap<string, int> table;
+	bool inserted = false;
+	EXPECT_EQ(table.find_or_insert(std::string_view("x"), [](std::string_view key) { return (int)key.size(); }, &inserted), 1);
+	EXPECT_TRUE(inserted);
+	int value = 0;
+	EXPECT_TRUE(table.find("x", &value));
+	EXPECT_EQ(value, 1);
+	EXPECT_TRUE(table.erase(std::string_view("x")));
+	EXPECT_EQ(table.size(), 0u);
+}
+
+TEST(HeterogeneousLookupTest, Netlist) {
+	MockNetlist mock;
+	EXPECT_EQ(mock.netIndex("a", true), 0);
+	EXPECT_EQ(mock.netIndex(std::string_view("a'1"), false), 1);
+	EXPECT_EQ(mock.netIndex(std::string_view("a'1")), 1);
+	EXPECT_EQ(mock.netIndex("b"), -1);
+
+	ucs::ConstNetlist nets(mock);
+	EXPECT_EQ(nets.netIndex("a'1"), 1);
+	EXPECT_EQ(nets.netAt(1), "a'1");
+}
@@ -0,0 +1,78 @@
+// The lookup counters are only compiled in with HASH_STATS. Every table
+// here is keyed by a type local to this file, so none of its instantiations
+// are shared with files built without the counters.
+#define HASH_STATS
+
+#include <gtest/gtest.h>
+#include <common/hash.h>
+#include <common/message.h>
+#include <vector>
+#include <thread>
+
+namespace {
+
+enum class stat_key : uint32_t {};
+
+}
+
+TEST(HashStatsTest, CountsLookupsAndRehashes) {
+	flat_hashmap<stat_key, int> map;
+	flat_hashset<stat_key> set;
+	for (uint32_t i = 0; i < 1000; i++) {
+		map.insert(stat_key(i), (int)i);
+		set.insert(stat_key(i));
+	}
+	for (uint32_t i = 0; i < 2000; i++) {
+		map.find(stat_key(i));
+		set.contains(stat_key(i));
+	}
+
+	hash_stats map_stats = map.stats();
+	hash_stats set_stats = set.stats();
+	EXPECT_GE(map_stats.lookups, 2000u);
+	EXPECT_GE(set_stats.lookups, 2000u);
+	EXPECT_GE(map_stats.probes, map_stats.lookups);
+	EXPECT_GE(map_stats.max_probe, 1u);
+	EXPECT_GT(map_stats.rehashes, 0u);
+	EXPECT_GT(set_stats.rehashes, 0u);
+	EXPECT_GE(map_stats.average_probe(), 1.0f);
+
+	// A copy keeps the counts so far
+	flat_hashmap<stat_key, int> copy = map;
+	EXPECT_EQ(copy.stats().lookups, map_stats.lookups);
+
+	bool verbose = get_verbose();
+	set_verbose(true);
+	testing::internal::CaptureStdout();
+	map_stats.dump("map");
+	string output = testing::internal::GetCapturedStdout();
+	set_verbose(verbose);
+	EXPECT_NE(output.find("lookups, average probe"), string::npos);
+	EXPECT_NE(output.find("rehashes"), string::npos);
+}
+
+// Lookups run under a shared lock, so the counters must not lose updates
+// when many threads search the same shard at once.
+TEST(HashStatsTest, ConcurrentLookupsAreCounted) {
+	concurrent_hashmap<stat_key, int, 1> map;
+	for (uint32_t i = 0; i < 100; i++) {
+		map.insert(stat_key(i), (int)i);
+	}
+	uint64_t before = map.shards[0].table.stats().lookups;
+
+	const int num_threads = 4;
+	const int per_thread = 10000;
+	vector<thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.emplace_back([&map]() {
+			for (int i = 0; i < per_thread; i++) {
+				map.find(stat_key(i%100));
+			}
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	EXPECT_EQ(map.shards[0].table.stats().lookups - before, (uint64_t)num_threads*per_thread);
+}
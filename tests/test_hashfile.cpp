@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+#include <common/hashfile.h>
+#include <common/timer.h>
+#include <stdio.h>
+#include <stddef.h>
+
+static string temp_path(string name) {
+	return testing::TempDir() + name;
+}
+
+TEST(HashfileTest, WriteAndFind) {
+	string path = temp_path("hashfile_strings.bin");
+	hashfile_writer<string, int> writer;
+	for (int i = 0; i < 10000; i++) {
+		writer.insert("net" + ::to_string(i), i);
+	}
+	// The first value stored under a key wins
+	writer.insert("net5", -1);
+	ASSERT_TRUE(writer.write(path));
+
+	hashfile_map<string, int> table;
+	ASSERT_TRUE(table.open(path));
+	EXPECT_EQ(table.size(), 10000u);
+	for (int i = 0; i < 10000; i++) {
+		int value = -1;
+		ASSERT_TRUE(table.find("net" + ::to_string(i), &value));
+		EXPECT_EQ(value, i);
+	}
+	EXPECT_FALSE(table.find("net10000"));
+	EXPECT_FALSE(table.find(""));
+	remove(path.c_str());
+}
+
+TEST(HashfileTest, IntegerKeys) {
+	struct location {
+		int x, y;
+	};
+
+	string path = temp_path("hashfile_ints.bin");
+	hashfile_writer<long long, location> writer;
+	for (long long i = 0; i < 1000; i++) {
+		writer.insert(i*i, location{(int)i, (int)-i});
+	}
+	ASSERT_TRUE(writer.write(path));
+
+	hashfile_map<long long, location> table;
+	ASSERT_TRUE(table.open(path));
+	location loc;
+	ASSERT_TRUE(table.find(81, &loc));
+	EXPECT_EQ(loc.x, 9);
+	EXPECT_EQ(loc.y, -9);
+	EXPECT_FALSE(table.find(82, &loc));
+	remove(path.c_str());
+}
+
+TEST(HashfileTest, RejectsBadFiles) {
+	string path = temp_path("hashfile_bad.bin");
+	hashfile_map<string, int> table;
+	EXPECT_FALSE(table.open(path + ".missing"));
+
+	FILE *fptr = fopen(path.c_str(), "wb");
+	string junk(200, 'x');
+	fwrite(junk.data(), 1, junk.size(), fptr);
+	fclose(fptr);
+	EXPECT_FALSE(table.open(path));
+
+	// A table written with one value type cannot be opened with another
+	hashfile_writer<string, int> writer;
+	writer.insert("a", 1);
+	ASSERT_TRUE(writer.write(path));
+	hashfile_map<string, double> wrong;
+	EXPECT_FALSE(wrong.open(path));
+	EXPECT_TRUE(table.open(path));
+	remove(path.c_str());
+}
+
+// Rewrite part of a valid file and check that open() rejects it
+static bool open_patched(string path, size_t offset, const void *data, size_t size) {
+	hashfile_writer<string, int> writer;
+	for (int i = 0; i < 10; i++) {
+		writer.insert("key" + ::to_string(i), i);
+	}
+	if (!writer.write(path)) {
+		return true;
+	}
+	FILE *fptr = fopen(path.c_str(), "r+b");
+	if (size > 0) {
+		fseek(fptr, offset, SEEK_SET);
+		fwrite(data, 1, size, fptr);
+	}
+	fclose(fptr);
+
+	hashfile_map<string, int> table;
+	bool result = table.open(path);
+	remove(path.c_str());
+	return result;
+}
+
+TEST(HashfileTest, RejectsCorruptSlots) {
+	string path = temp_path("hashfile_corrupt.bin");
+	EXPECT_TRUE(open_patched(path, 0, NULL, 0));
+
+	// Find the layout of the file and one of its occupied slots
+	hashfile_writer<string, int> writer;
+	for (int i = 0; i < 10; i++) {
+		writer.insert("key" + ::to_string(i), i);
+	}
+	ASSERT_TRUE(writer.write(path));
+	hashfile file;
+	ASSERT_TRUE(file.open(path, sizeof(int)));
+	hashfile_header header = *file.header();
+	uint64_t slot = 0;
+	while (file.slots()[slot].value == hashfile_slot::empty) {
+		slot++;
+	}
+	file.close();
+	remove(path.c_str());
+
+	// Slots that point outside their sections
+	size_t slot_offset = header.slots_offset + slot*sizeof(hashfile_slot);
+	uint64_t far_key = (uint64_t)1 << 60;
+	uint32_t long_key = 0xFFFFFFF0;
+	uint32_t far_value = 1000;
+	EXPECT_FALSE(open_patched(path, slot_offset + offsetof(hashfile_slot, key_offset), &far_key, sizeof(far_key)));
+	EXPECT_FALSE(open_patched(path, slot_offset + offsetof(hashfile_slot, key_size), &long_key, sizeof(long_key)));
+	EXPECT_FALSE(open_patched(path, slot_offset + offsetof(hashfile_slot, value), &far_value, sizeof(far_value)));
+
+	// A capacity so large that its size in bytes overflows
+	uint64_t overflow = (uint64_t)1 << 62;
+	EXPECT_FALSE(open_patched(path, offsetof(hashfile_header, capacity), &overflow, sizeof(overflow)));
+
+	// A table with no empty slot would make find() probe forever
+	vector<hashfile_slot> full(header.capacity);
+	for (uint64_t i = 0; i < header.capacity; i++) {
+		full[i].hash = i;
+		full[i].key_offset = 0;
+		full[i].key_size = 0;
+		full[i].value = 0;
+	}
+	uint64_t count = header.capacity;
+	EXPECT_FALSE(open_patched(path, header.slots_offset, full.data(), full.size()*sizeof(hashfile_slot)));
+	EXPECT_FALSE(open_patched(path, offsetof(hashfile_header, count), &count, sizeof(count)));
+}
+
+TEST(HashBenchmark, DISABLED_HashfileLoadVsRebuild) {
+	const int num_keys = 1000000;
+	string path = temp_path("hashfile_bench.bin");
+	vector<string> keys;
+	for (int i = 0; i < num_keys; i++) {
+		keys.push_back("top.module" + ::to_string(i%97) + ".net" + ::to_string(i));
+	}
+
+	hashfile_writer<string, int> writer;
+	for (int i = 0; i < num_keys; i++) {
+		writer.insert(keys[i], i);
+	}
+	Timer timer;
+	ASSERT_TRUE(writer.write(path));
+	float write_time = timer.since();
+
+	timer.reset();
+	flat_hashmap<string, int> rebuilt;
+	for (int i = 0; i < num_keys; i++) {
+		rebuilt.insert(keys[i], i);
+	}
+	float rebuild_time = timer.since();
+
+	timer.reset();
+	hashfile_map<string, int> table;
+	ASSERT_TRUE(table.open(path));
+	float open_time = timer.since();
+
+	timer.reset();
+	int found = 0;
+	for (int i = 0; i < num_keys; i++) {
+		found += table.find(keys[i]);
+	}
+	float find_time = timer.since();
+	EXPECT_EQ(found, num_keys);
+
+	cout << "write hashfile:       " << write_time << "s" << endl;
+	cout << "rebuild flat_hashmap: " << rebuild_time << "s" << endl;
+	cout << "open hashfile:        " << open_time << "s" << endl;
+	cout << "find all in hashfile: " << find_time << "s" << endl;
+	remove(path.c_str());
+}
@@ -0,0 +1,527 @@
+#include <gtest/gtest.h>
+#include <common/index_vector.h>
+#include <common/timer.h>
+#include <string>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+
+TEST(IndexVectorTest, EmplaceEraseReuse) {
+	index_vector<std::string> v;
+	for (int i = 0; i < 200; i++) {
+		EXPECT_EQ(v.next_index(), (size_t)i);
+		EXPECT_EQ(v.emplace(std::to_string(i)), (size_t)i);
+	}
+	EXPECT_EQ(v.count(), 200u);
+
+	EXPECT_TRUE(v.erase(130));
+	EXPECT_TRUE(v.erase(5));
+	EXPECT_TRUE(v.erase(70));
+	EXPECT_FALSE(v.erase(70));
+	EXPECT_FALSE(v.erase(500));
+	EXPECT_EQ(v.count(), 197u);
+	EXPECT_FALSE(v.is_valid(5));
+	EXPECT_THROW(v.at(5), std::out_of_range);
+
+	// Freed slots are reused lowest first
+	EXPECT_EQ(v.next_index(), 5u);
+	EXPECT_EQ(v.emplace("a"), 5u);
+	EXPECT_EQ(v.next_index(), 70u);
+	EXPECT_EQ(v.emplace("b"), 70u);
+	EXPECT_EQ(v.emplace("c"), 130u);
+	EXPECT_EQ(v.emplace("d"), 200u);
+	EXPECT_EQ(v.count(), 201u);
+	EXPECT_EQ(v[70], "b");
+}
+
+TEST(IndexVectorTest, EmplaceAt) {
+	index_vector<int> v;
+	v.emplace_at(100, 7);
+	EXPECT_EQ(v.size(), 101u);
+	EXPECT_EQ(v.count(), 1u);
+	EXPECT_EQ(v.next_index(), 0u);
+
+	v.emplace_at(0, 1);
+	v.emplace_at(0, 2);
+	EXPECT_EQ(v.count(), 2u);
+	EXPECT_EQ(v[0], 2);
+	EXPECT_EQ(v.emplace(3), 1u);
+
+	v.clear();
+	EXPECT_EQ(v.count(), 0u);
+	EXPECT_EQ(v.next_index(), 0u);
+}
+
+TEST(IndexVectorTest, SparseIteration) {
+	index_vector<int> v;
+	for (int i = 0; i < 1000; i++) {
+		v.emplace(i);
+	}
+	std::vector<int> expect;
+	for (int i = 0; i < 1000; i++) {
+		if (i%97 == 3 or i == 999) {
+			expect.push_back(i);
+		} else {
+			v.erase(i);
+		}
+	}
+
+	std::vector<int> forward;
+	for (auto i = v.begin(); i != v.end(); i++) {
+		forward.push_back(*i);
+	}
+	EXPECT_EQ(forward, expect);
+
+	std::vector<int> backward;
+	for (auto i = v.rbegin(); i != v.rend(); i++) {
+		backward.push_back(*i);
+	}
+	std::reverse(backward.begin(), backward.end());
+	EXPECT_EQ(backward, expect);
+
+	const index_vector<int> &c = v;
+	EXPECT_EQ((size_t)std::distance(c.begin(), c.end()), expect.size());
+
+	Mapping<size_t> renumber = v.compact();
+	for (size_t i = 0; i < expect.size(); i++) {
+		EXPECT_EQ(renumber.map(expect[i]), i);
+	}
+	EXPECT_EQ(renumber.map(4), size_t(-1));
+	EXPECT_EQ(renumber.map(5000), size_t(-1));
+	EXPECT_TRUE(renumber.fwd.isDense());
+	EXPECT_EQ(v.size(), expect.size());
+	EXPECT_EQ(v.count(), expect.size());
+	EXPECT_EQ(v.next_index(), expect.size());
+	EXPECT_EQ(v[1], 100);
+
+	// Slots past a partially filled word are free again after growing
+	v.emplace_at(expect.size()+3, -1);
+	EXPECT_EQ(v.next_index(), expect.size());
+}
+
+TEST(IndexVectorTest, GenerationalHandles) {
+	static_assert(sizeof(index_handle) == 8);
+	static_assert(sizeof(index_vector<int>) < sizeof(generational_index_vector<int>));
+
+	generational_index_vector<std::string> v;
+	index_handle a = v.emplace_handle("a");
+	index_handle b = v.emplace_handle("b");
+	EXPECT_EQ(a.index, 0u);
+	EXPECT_EQ(b.index, 1u);
+	EXPECT_TRUE(v.is_valid(a));
+	EXPECT_EQ(v.at(b), "b");
+
+	EXPECT_TRUE(v.erase(a));
+	EXPECT_FALSE(v.erase(a));
+	index_handle c = v.emplace_handle("c");
+	EXPECT_EQ(c.index, a.index);
+	EXPECT_NE(c, a);
+	EXPECT_FALSE(v.is_valid(a));
+	EXPECT_THROW(v.at(a), std::out_of_range);
+	EXPECT_EQ(v.at(c), "c");
+	EXPECT_EQ(v.handle(0), c);
+
+	// Erasing by raw index also retires the handle
+	v.erase(b.index);
+	EXPECT_FALSE(v.is_valid(b));
+
+	v.emplace_at(5, "d");
+	index_handle d = v.handle(5);
+	EXPECT_EQ(v.at(d), "d");
+
+	// Replacing an element in place also retires the handle
+	v.emplace_at(5, "d2");
+	EXPECT_FALSE(v.is_valid(d));
+	d = v.handle(5);
+	EXPECT_EQ(v.at(d), "d2");
+
+	// A handle cannot name an index past 32 bits
+	EXPECT_THROW(v.handle((size_t)UINT32_MAX + 1), std::out_of_range);
+
+	v.compact();
+	EXPECT_FALSE(v.is_valid(c));
+	EXPECT_FALSE(v.is_valid(d));
+	EXPECT_EQ(v.at(v.handle(1)), "d2");
+
+	index_handle e = v.handle(0);
+	v.clear();
+	v.emplace("e");
+	EXPECT_FALSE(v.is_valid(e));
+}
+
+TEST(IndexVectorTest, CompactRemapsReferences) {
+	index_vector<std::vector<int> > v;
+	std::vector<size_t> refs;
+	for (int i = 0; i < 100; i++) {
+		v.emplace(std::vector<int>(3, i));
+	}
+	for (int i = 0; i < 100; i += 3) {
+		v.erase(i);
+	}
+	for (int i = 1; i < 100; i += 3) {
+		refs.push_back(i);
+	}
+
+	Mapping<size_t> m = v.compact();
+	std::vector<size_t> moved = refs;
+	m.mapInPlace(std::span<size_t>(moved));
+	ASSERT_EQ(moved.size(), refs.size());
+	for (size_t i = 0; i < refs.size(); i++) {
+		EXPECT_EQ(v[moved[i]], std::vector<int>(3, (int)refs[i]));
+	}
+	EXPECT_EQ(v.count(), 66u);
+	EXPECT_EQ(v.size(), 66u);
+}
+
+namespace {
+
+// Counts live objects and how each one was made
+struct tracked {
+	static int alive;
+	static int copies;
+	static int moves;
+
+	tracked(int value = 0) : value(value) { alive++; }
+	tracked(const tracked &other) : value(other.value) { alive++; copies++; }
+	tracked(tracked &&other) noexcept : value(other.value) { alive++; moves++; }
+	tracked &operator=(const tracked &other) { value = other.value; copies++; return *this; }
+	tracked &operator=(tracked &&other) noexcept { value = other.value; moves++; return *this; }
+	~tracked() { alive--; }
+
+	int value;
+
+	static void reset() {
+		alive = 0;
+		copies = 0;
+		moves = 0;
+	}
+};
+
+int tracked::alive = 0;
+int tracked::copies = 0;
+int tracked::moves = 0;
+
+// Throws from its constructor when asked to
+struct fragile {
+	fragile(int value) : value(value) {
+		if (value < 0) {
+			throw std::runtime_error("fragile");
+		}
+	}
+
+	int value;
+};
+
+// Counts live objects, and throws from its copy once copies runs out
+struct flaky {
+	static int alive;
+	static int copies;
+
+	flaky() { alive++; }
+	flaky(const flaky &) {
+		if (copies-- == 0) {
+			throw std::runtime_error("flaky");
+		}
+		alive++;
+	}
+	~flaky() { alive--; }
+};
+
+int flaky::alive = 0;
+int flaky::copies = 0;
+
+}
+
+TEST(IndexVectorTest, LazyConstruction) {
+	tracked::reset();
+	{
+		index_vector<tracked> v;
+		for (int i = 0; i < 10; i++) {
+			v.emplace(i);
+		}
+		EXPECT_EQ(tracked::alive, 10);
+		EXPECT_EQ(tracked::copies, 0);
+
+		// Erasing destroys the element straight away
+		v.erase(3);
+		v.erase(4);
+		EXPECT_EQ(tracked::alive, 8);
+
+		// Reuse constructs in place, with no temporary to move from
+		int moves = tracked::moves;
+		v.emplace(30);
+		EXPECT_EQ(tracked::moves, moves);
+		EXPECT_EQ(tracked::alive, 9);
+		EXPECT_EQ(v[3].value, 30);
+
+		// Filling a dead slot also constructs in place
+		moves = tracked::moves;
+		v.emplace_at(4, 40);
+		EXPECT_EQ(tracked::moves, moves);
+		EXPECT_EQ(tracked::alive, 10);
+		v.erase(4);
+
+		// Growing past the end leaves the gap unconstructed
+		v.emplace_at(100, 100);
+		EXPECT_EQ(tracked::alive, 10);
+		v.emplace_at(100, 101);
+		EXPECT_EQ(tracked::alive, 10);
+		EXPECT_EQ(v[100].value, 101);
+
+		index_vector<tracked> copy = v;
+		EXPECT_EQ(tracked::alive, 20);
+		EXPECT_EQ(copy[100].value, 101);
+		EXPECT_FALSE(copy.is_valid(4));
+
+		index_vector<tracked> moved = std::move(copy);
+		EXPECT_EQ(tracked::alive, 20);
+		EXPECT_EQ(copy.count(), 0u);
+		EXPECT_EQ(moved.count(), 10u);
+
+		copy = moved;
+		EXPECT_EQ(tracked::alive, 30);
+
+		v.compact();
+		EXPECT_EQ(tracked::alive, 30);
+		v.clear();
+		EXPECT_EQ(tracked::alive, 20);
+	}
+	EXPECT_EQ(tracked::alive, 0);
+
+	{
+		segmented_index_vector<tracked> v;
+		for (int i = 0; i < 1000; i++) {
+			v.emplace(i);
+		}
+		for (int i = 0; i < 1000; i += 2) {
+			v.erase(i);
+		}
+		EXPECT_EQ(tracked::alive, 500);
+		segmented_index_vector<tracked> copy = v;
+		EXPECT_EQ(tracked::alive, 1000);
+		EXPECT_EQ(copy[999].value, 999);
+	}
+	EXPECT_EQ(tracked::alive, 0);
+}
+
+// The arguments to emplace may refer to elements of the same table, which
+// growing or replacing must not invalidate before the new element is built.
+TEST(IndexVectorTest, EmplaceFromOwnElement) {
+	index_vector<std::string> v;
+	v.emplace(std::string(100, 'x'));
+	for (int i = 0; i < 100; i++) {
+		v.insert(v[0]);
+	}
+	EXPECT_EQ(v.count(), 101u);
+	EXPECT_EQ(v[100], std::string(100, 'x'));
+
+	index_vector<std::string> w;
+	w.emplace(std::string(100, 'y'));
+	w.emplace_at(0, w[0]);
+	EXPECT_EQ(w[0], std::string(100, 'y'));
+	w.emplace_at(1000, w[0]);
+	EXPECT_EQ(w[1000], std::string(100, 'y'));
+
+	// A throwing constructor leaves the old element in place
+	index_vector<fragile> f;
+	f.emplace(1);
+	EXPECT_THROW(f.emplace_at(0, -1), std::runtime_error);
+	EXPECT_TRUE(f.is_valid(0));
+	EXPECT_EQ(f[0].value, 1);
+	EXPECT_THROW(f.emplace_at(5, -1), std::runtime_error);
+	EXPECT_FALSE(f.is_valid(5));
+}
+
+// A copy that throws partway must destroy the elements it already built
+TEST(IndexVectorTest, CopyThrows) {
+	{
+		index_vector<flaky> v;
+		// Growing the buffer copies too, since flaky has no move
+		flaky::copies = 1000;
+		for (int i = 0; i < 10; i++) {
+			v.emplace();
+		}
+		flaky::copies = 5;
+		EXPECT_THROW(index_vector<flaky> copy(v), std::runtime_error);
+		EXPECT_EQ(flaky::alive, 10);
+	}
+	EXPECT_EQ(flaky::alive, 0);
+}
+
+TEST(IndexVectorTest, MoveOnlyElements) {
+	// Nested tables are moved, not copied, when their container grows
+	static_assert(std::is_nothrow_move_constructible_v<index_vector<int> >);
+	static_assert(std::is_nothrow_move_constructible_v<segmented_index_vector<std::string> >);
+
+	index_vector<std::unique_ptr<int> > v;
+	for (int i = 0; i < 100; i++) {
+		v.emplace(std::make_unique<int>(i));
+	}
+	v.erase(50);
+	EXPECT_EQ(v.emplace(std::make_unique<int>(-1)), 50u);
+	EXPECT_EQ(*v[50], -1);
+	EXPECT_EQ(*v[99], 99);
+	v.erase(0);
+	v.compact();
+	EXPECT_EQ(*v[0], 1);
+}
+
+TEST(IndexVectorBenchmark, DISABLED_SparseIterate) {
+	const int n = 4000000;
+	index_vector<int> v;
+	for (int i = 0; i < n; i++) {
+		v.emplace(i);
+	}
+	for (int i = 0; i < n; i++) {
+		if (i%64 != 0) {
+			v.erase(i);
+		}
+	}
+
+	Timer timer;
+	long long sum = 0;
+	for (int pass = 0; pass < 10; pass++) {
+		for (auto i = v.begin(); i != v.end(); i++) {
+			sum += *i;
+		}
+	}
+	float iterate_time = timer.since();
+
+	timer.reset();
+	for (int i = 0; i < n; i++) {
+		v.emplace(i);
+	}
+	float refill_time = timer.since();
+
+	EXPECT_EQ(v.count(), (size_t)n);
+	std::cout << "iterate 1/64 live x10 " << iterate_time << "s (" << sum << ")" << std::endl;
+	std::cout << "refill free slots " << refill_time << "s" << std::endl;
+}
+
+TEST(IndexVectorBenchmark, DISABLED_CompactInPlace) {
+	const int n = 4000000;
+	index_vector<std::string> v;
+	for (int i = 0; i < n; i++) {
+		v.emplace(std::to_string(i));
+	}
+	for (int i = 0; i < n; i++) {
+		if (i%4 != 0) {
+			v.erase(i);
+		}
+	}
+
+	std::vector<size_t> refs;
+	for (size_t i = 0; i < (size_t)n; i += 8) {
+		refs.push_back(i);
+	}
+
+	Timer timer;
+	Mapping<size_t> m = v.compact();
+	float compact_time = timer.since();
+
+	timer.reset();
+	m.mapInPlace(std::span<size_t>(refs));
+	float remap_time = timer.since();
+
+	EXPECT_EQ(v.count(), (size_t)n/4);
+	EXPECT_EQ(v[refs[1]], "8");
+	std::cout << "compact 4M slots to 1M " << compact_time << "s" << std::endl;
+	std::cout << "remap 500k references " << remap_time << "s" << std::endl;
+}
+
+TEST(IndexVectorTest, SegmentedStableAddresses) {
+	segmented_index_vector<std::string> v;
+	v.emplace("first");
+	std::string *first = &v[0];
+	for (int i = 1; i < 100000; i++) {
+		EXPECT_EQ(v.emplace(std::to_string(i)), (size_t)i);
+	}
+	EXPECT_EQ(first, &v[0]);
+	EXPECT_EQ(*first, "first");
+	EXPECT_EQ(v[99999], "99999");
+	EXPECT_GE(v.capacity(), v.size());
+
+	// Slots 64 through 191 make up the second block
+	size_t b = index_segments<std::string>::block_of(100);
+	EXPECT_EQ(b, 1u);
+	for (int i = 64; i < 192; i++) {
+		v.erase(i);
+	}
+	EXPECT_FALSE(v.elems.blocks[b]);
+	// The emptied block is kept as the spare and handed back on reuse
+	std::string *spare = v.elems.spare.get();
+	EXPECT_TRUE(spare != nullptr);
+	EXPECT_EQ(v.emplace("reused"), 64u);
+	EXPECT_EQ(v.elems.blocks[b].get(), spare);
+	EXPECT_FALSE(v.elems.spare);
+	EXPECT_EQ(v[64], "reused");
+
+	segmented_index_vector<std::string> copy = v;
+	EXPECT_EQ(copy.count(), v.count());
+	EXPECT_EQ(copy[99999], "99999");
+
+	Mapping<size_t> m = v.compact();
+	EXPECT_EQ(v.count(), 100000u - 127u);
+	EXPECT_EQ(v[m.map(99999)], "99999");
+	EXPECT_EQ(v[65], "192");
+
+	v.emplace_at(200000, "far");
+	EXPECT_EQ(v[200000], "far");
+	EXPECT_EQ(v.count(), 100000u - 126u);
+}
+
+TEST(IndexVectorBenchmark, DISABLED_SegmentedGrowth) {
+	const int n = 8000000;
+	Timer timer;
+	index_vector<std::string> flat;
+	for (int i = 0; i < n; i++) {
+		flat.emplace("net");
+	}
+	float flat_time = timer.since();
+
+	timer.reset();
+	segmented_index_vector<std::string> segmented;
+	for (int i = 0; i < n; i++) {
+		segmented.emplace("net");
+	}
+	float segmented_time = timer.since();
+
+	timer.reset();
+	size_t total = 0;
+	for (auto i = flat.begin(); i != flat.end(); i++) {
+		total += i->size();
+	}
+	float flat_scan = timer.since();
+
+	timer.reset();
+	for (auto i = segmented.begin(); i != segmented.end(); i++) {
+		total += i->size();
+	}
+	float segmented_scan = timer.since();
+
+	EXPECT_EQ(total, 6u*n);
+	std::cout << "grow vector " << flat_time << "s, segmented " << segmented_time << "s" << std::endl;
+	std::cout << "scan vector " << flat_scan << "s, segmented " << segmented_scan << "s" << std::endl;
+}
+
+TEST(IndexVectorBenchmark, DISABLED_ReuseFreedSlots) {
+	const int n = 1000000;
+	index_vector<std::vector<int> > v;
+	for (int i = 0; i < n; i++) {
+		v.emplace(std::vector<int>(16, i));
+	}
+
+	Timer timer;
+	for (int pass = 0; pass < 5; pass++) {
+		for (int i = 0; i < n; i += 2) {
+			v.erase(i);
+		}
+		for (int i = 0; i < n; i += 2) {
+			v.emplace(16, i);
+		}
+	}
+	float reuse_time = timer.since();
+
+	EXPECT_EQ(v.count(), (size_t)n);
+	std::cout << "erase and refill half of 1M vector<int> slots x5 " << reuse_time << "s" << std::endl;
+}
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <common/mapping.h>
+#include <common/timer.h>
 #include <vector>
 
 // Test mapping and unmapping functions
@@ -171,3 +172,649 @@ TEST(MappingTest, ComplexMappingChains) {
 		//EXPECT_EQ(result.map(reverse_result.map(i)), i);
 	}
 } 
+
+TEST(DenseMapTest, MatchesStdMap) {
+	DenseMap<int> dense;
+	std::map<int, int> expect;
+	srand(7);
+	for (int i = 0; i < 20000; i++) {
+		int key = rand()%1000;
+		int op = rand()%4;
+		if (op == 0) {
+			EXPECT_EQ(dense.erase(key), expect.erase(key));
+		} else if (op == 1) {
+			EXPECT_EQ(dense.insert({key, i}).second, expect.insert({key, i}).second);
+		} else {
+			dense[key] = i;
+			expect[key] = i;
+		}
+	}
+	EXPECT_TRUE(dense.isDense());
+	ASSERT_EQ(dense.size(), expect.size());
+	auto j = expect.begin();
+	for (auto i = dense.begin(); i != dense.end(); i++, j++) {
+		EXPECT_EQ(i->first, j->first);
+		EXPECT_EQ(i->second, j->second);
+	}
+
+	// The rest of the std::map interface, in both modes
+	for (int mode = 0; mode < 2; mode++) {
+		auto r = expect.rbegin();
+		for (auto i = dense.rbegin(); i != dense.rend(); i++, r++) {
+			EXPECT_EQ(i->first, r->first);
+			EXPECT_EQ(i->second, r->second);
+		}
+		EXPECT_TRUE(r == expect.rend());
+		for (int key = -2; key < 1002; key++) {
+			auto lower = dense.lower_bound(key);
+			auto upper = dense.upper_bound(key);
+			if (expect.lower_bound(key) == expect.end()) {
+				EXPECT_TRUE(lower == dense.end());
+			} else {
+				EXPECT_EQ(lower->first, expect.lower_bound(key)->first);
+			}
+			if (expect.upper_bound(key) == expect.end()) {
+				EXPECT_TRUE(upper == dense.end());
+			} else {
+				EXPECT_EQ(upper->first, expect.upper_bound(key)->first);
+			}
+			if (expect.count(key)) {
+				EXPECT_EQ(dense.at(key), expect.at(key));
+			} else {
+				EXPECT_THROW(dense.at(key), std::out_of_range);
+			}
+		}
+		EXPECT_EQ(dense.emplace(-5, 1).second, expect.emplace(-5, 1).second);
+		EXPECT_FALSE(dense.isDense());
+	}
+}
+
+TEST(DenseMapTest, FallsBackToSparse) {
+	DenseMap<int> m;
+	m[3] = 5;
+	m[0] = 1;
+	EXPECT_TRUE(m.isDense());
+	EXPECT_EQ(m.slots.size(), 4u);
+
+	m[-1] = 2;
+	EXPECT_FALSE(m.isDense());
+	EXPECT_EQ(m.size(), 3u);
+	std::vector<std::pair<int, int> > entries(m.begin(), m.end());
+	EXPECT_EQ(entries, (std::vector<std::pair<int, int> >{{-1, 2}, {0, 1}, {3, 5}}));
+
+	DenseMap<size_t> huge;
+	huge[1] = 1;
+	huge[(size_t)1 << 40] = 2;
+	EXPECT_FALSE(huge.isDense());
+	EXPECT_EQ(huge.find((size_t)1 << 40)->second, 2u);
+
+	m.clear();
+	EXPECT_TRUE(m.isDense());
+	EXPECT_TRUE(m.empty());
+}
+
+// Keys that start out too sparse for the array move back into it once
+// enough of the range is filled in.
+TEST(DenseMapTest, ReturnsToDense) {
+	DenseMap<int> m;
+	for (int i = 4999; i >= 0; i--) {
+		m[i] = i*2;
+	}
+	EXPECT_TRUE(m.isDense());
+	EXPECT_EQ(m.size(), 5000u);
+	int expect = 0;
+	for (auto &entry : m) {
+		EXPECT_EQ(entry.first, expect);
+		EXPECT_EQ(entry.second, expect*2);
+		expect++;
+	}
+	EXPECT_EQ(expect, 5000);
+
+	// Emptying most of the array gives its memory back
+	for (int i = 100; i < 5000; i++) {
+		m.erase(i);
+	}
+	EXPECT_TRUE(m.isDense());
+	EXPECT_LE(m.slots.size(), 4*m.size() + DenseMap<int>::slack);
+	std::vector<std::pair<int, int> > entries(m.begin(), m.end());
+	ASSERT_EQ(entries.size(), 100u);
+	EXPECT_EQ(entries.back(), std::make_pair(99, 198));
+}
+
+// An outlier inserted and erased over and over must not move every entry
+// between the array and the sparse map each time.
+TEST(DenseMapTest, OutlierDoesNotThrash) {
+	DenseMap<int> m;
+	for (int i = 0; i < 1000; i++) {
+		m[i] = i;
+	}
+	ASSERT_TRUE(m.isDense());
+
+	int outlier = 2*1001 + (int)DenseMap<int>::slack;
+	int flips = 0;
+	bool dense = true;
+	for (int k = 0; k < 100; k++) {
+		m[outlier] = 1;
+		flips += (int)(m.isDense() != dense);
+		dense = m.isDense();
+		auto next = m.erase(m.find(outlier));
+		EXPECT_TRUE(next == m.end());
+		flips += (int)(m.isDense() != dense);
+		dense = m.isDense();
+	}
+	EXPECT_LE(flips, 1);
+	EXPECT_EQ(m.size(), 1000u);
+
+	// Once enough has happened to pay for it, the entries go back
+	for (int k = 0; k < 1000; k++) {
+		m[1500] = k;
+		m.erase(1500);
+	}
+	EXPECT_TRUE(m.isDense());
+	EXPECT_EQ(m.size(), 1000u);
+	EXPECT_EQ(m.find(999)->second, 999);
+}
+
+TEST(MappingTest, DenseAndSparseAgree) {
+	Mapping<int> dense(-1, false);
+	Mapping<int> sparse(-1, false);
+	// The negative key keeps sparse out of the array. It maps to a value
+	// that the other keys already reach, so the queries below still agree.
+	sparse.set(-100, 0);
+	for (int i = 0; i < 100; i++) {
+		dense.set(i, (i*7)%100);
+		sparse.set(i, (i*7)%100);
+	}
+	EXPECT_TRUE(dense.fwd.isDense());
+	EXPECT_FALSE(sparse.fwd.isDense());
+
+	dense.update(14, -1);
+	sparse.update(14, -1);
+	for (int i = -5; i < 105; i++) {
+		EXPECT_EQ(dense.map(i), sparse.map(i));
+		EXPECT_EQ(dense.mapsTo(i), sparse.mapsTo(i));
+	}
+	EXPECT_EQ(dense.map(std::vector<int>{1, 2, 200}), sparse.map(std::vector<int>{1, 2, 200}));
+	EXPECT_EQ(dense.toSize(), sparse.toSize());
+
+	Mapping<int> sum(-1, false);
+	sum += dense;
+	EXPECT_EQ(sum.map(3), 21);
+}
+
+TEST(MappingBenchmark, DISABLED_DenseRemap) {
+	const int n = 10000000;
+	std::vector<int> ids(n);
+	for (int i = 0; i < n; i++) {
+		ids[i] = (int)(((long long)i*7919)%n);
+	}
+
+	Timer timer;
+	Mapping<int> m(-1, false);
+	for (int i = 0; i < n; i++) {
+		m.set(i, ids[i]);
+	}
+	float dense_build = timer.since();
+
+	timer.reset();
+	std::vector<int> dense_result = m.map(ids);
+	float dense_time = timer.since();
+
+	timer.reset();
+	std::map<int, int> tree;
+	for (int i = 0; i < n; i++) {
+		tree[i] = ids[i];
+	}
+	float tree_build = timer.since();
+
+	timer.reset();
+	std::vector<int> tree_result;
+	for (int i = 0; i < n; i++) {
+		auto pos = tree.find(ids[i]);
+		if (pos != tree.end()) {
+			tree_result.push_back(pos->second);
+		}
+	}
+	float tree_time = timer.since();
+
+	EXPECT_EQ(dense_result, tree_result);
+	std::cout << "dense build " << dense_build << "s, remap " << dense_time << "s" << std::endl;
+	std::cout << "std::map build " << tree_build << "s, remap " << tree_time << "s" << std::endl;
+}
+
+// Drive a MappingBidir and a Mapping with the same random operations and
+// check that every query agrees.
+TEST(MappingBidirTest, MatchesMapping) {
+	for (int identity = 0; identity < 2; identity++) {
+		Mapping<int> expect(-1, identity);
+		MappingBidir<int> actual(-1, identity);
+		srand(11 + identity);
+		for (int step = 0; step < 3000; step++) {
+			int from = rand()%40;
+			int to = rand()%45 - 1;
+			if (rand()%3 == 0) {
+				expect.update(from, to);
+				actual.update(from, to);
+			} else {
+				expect.set(from, to);
+				actual.set(from, to);
+			}
+
+			if (step%50 == 0) {
+				for (int t = -1; t < 45; t++) {
+					EXPECT_EQ(actual.unmap(t), expect.unmap(t));
+					EXPECT_EQ(actual.mapsTo(t), expect.mapsTo(t));
+					EXPECT_EQ(actual.map(t), expect.map(t));
+				}
+				EXPECT_EQ(actual.toSize(), expect.toSize());
+				EXPECT_EQ(actual.fromSize(), expect.fromSize());
+				EXPECT_EQ(actual.toMax(), expect.toMax());
+				EXPECT_EQ(actual.isBijective(), expect.isBijective());
+			}
+		}
+	}
+}
+
+TEST(MappingBidirTest, BijectionAndFlip) {
+	MappingBidir<int> m(-1, true);
+	m.set({{0, 1}, {1, 2}, {2, 0}});
+	EXPECT_FALSE(m.isBijective());
+	EXPECT_EQ(m.unmap(0), 2);
+
+	MappingBidir<int> inverse = m.flip();
+	for (int i = 0; i < 3; i++) {
+		EXPECT_EQ(inverse.map(m.map(i)), i);
+	}
+
+	m.set(3, 1);
+	EXPECT_TRUE(m.isBijective());
+	EXPECT_EQ(m.unmap(1), 0);
+
+	Mapping<int> shift(-1, true);
+	shift.set({{0, 10}, {1, 11}, {2, 12}});
+	m *= shift;
+	EXPECT_EQ(m.map(2), 10);
+	EXPECT_EQ(m.unmap(11), 0);
+	EXPECT_EQ(m.toSize(), m.fwd.toSize());
+}
+
+TEST(MappingBenchmark, DISABLED_BidirUnmapLoop) {
+	const int n = 20000;
+	Mapping<int> plain(-1, false);
+	MappingBidir<int> bidir(-1, false);
+	for (int i = 0; i < n; i++) {
+		plain.set(i, n-1-i);
+		bidir.set(i, n-1-i);
+	}
+
+	Timer timer;
+	long long plain_total = 0;
+	for (int i = 0; i < n; i++) {
+		plain_total += plain.unmap(i);
+	}
+	float plain_time = timer.since();
+
+	timer.reset();
+	long long bidir_total = 0;
+	for (int i = 0; i < n; i++) {
+		bidir_total += bidir.unmap(i);
+	}
+	float bidir_time = timer.since();
+
+	EXPECT_EQ(plain_total, bidir_total);
+	std::cout << "Mapping::unmap x" << n << ": " << plain_time << "s" << std::endl;
+	std::cout << "MappingBidir::unmap x" << n << ": " << bidir_time << "s" << std::endl;
+}
+
+// Composition must agree with applying each mapping in turn
+TEST(MappingTest, CompositionIsSequential) {
+	Mapping<int> keep(-1, true);
+	keep.set(1, 2);
+	Mapping<int> reset(-1, false);
+	reset.set({{0, 5}, {2, 6}});
+
+	Mapping<int> composed = keep*reset;
+	for (int i = 0; i < 4; i++) {
+		EXPECT_EQ(composed.map(i), reset.map(keep.map(i)));
+	}
+	EXPECT_EQ(composed.map(0), 5);
+}
+
+static Mapping<int> randomMapping(int n, bool identity) {
+	Mapping<int> result(-1, identity);
+	for (int j = 0; j < n/4; j++) {
+		int to = rand()%(n+1) - 1;
+		result.set(rand()%n, to);
+	}
+	return result;
+}
+
+TEST(MappingChainTest, MatchesSequentialComposition) {
+	srand(5);
+	const int n = 200;
+	for (int trial = 0; trial < 20; trial++) {
+		MappingChain<int> chain(-1);
+		Mapping<int> expect(-1);
+		int length = rand()%12;
+		for (int k = 0; k < length; k++) {
+			Mapping<int> m = randomMapping(n, rand()%4 != 0);
+			chain *= m;
+			expect *= m;
+		}
+
+		Mapping<int> flat = chain.flatten();
+		Mapping<int> parallel = chain.flatten(true);
+		for (int i = -1; i < n+5; i++) {
+			EXPECT_EQ(chain.map(i), expect.map(i));
+			EXPECT_EQ(flat.map(i), expect.map(i));
+			EXPECT_EQ(parallel.map(i), expect.map(i));
+		}
+		EXPECT_EQ(flat.identity, expect.identity);
+	}
+}
+
+// Enough links and entries to take the threaded path, with more pairs in
+// the first level than there are workers.
+TEST(MappingChainTest, ParallelMatchesSerial) {
+	srand(9);
+	const int n = 1000;
+	MappingChain<int> chain(-1);
+	for (int k = 0; k < 100; k++) {
+		chain *= randomMapping(n, rand()%8 != 0);
+	}
+
+	Mapping<int> flat = chain.flatten();
+	Mapping<int> parallel = chain.flatten(true);
+	EXPECT_EQ(parallel.identity, flat.identity);
+	for (int i = -1; i < n+5; i++) {
+		EXPECT_EQ(parallel.map(i), flat.map(i));
+	}
+}
+
+TEST(MappingBenchmark, DISABLED_ChainFlatten) {
+	const int n = 1000000;
+	const int k = 64;
+	srand(3);
+	std::vector<Mapping<int> > maps;
+	for (int j = 0; j < k; j++) {
+		Mapping<int> m(-1, true);
+		for (int i = 0; i < n/k; i++) {
+			m.set(rand()%n, rand()%n);
+		}
+		maps.push_back(m);
+	}
+
+	Timer timer;
+	Mapping<int> sequential(-1);
+	for (int j = 0; j < k; j++) {
+		sequential *= maps[j];
+	}
+	float sequential_time = timer.since();
+
+	MappingChain<int> chain(-1);
+	for (int j = 0; j < k; j++) {
+		chain *= maps[j];
+	}
+	timer.reset();
+	Mapping<int> tree = chain.flatten();
+	float tree_time = timer.since();
+
+	timer.reset();
+	Mapping<int> parallel = chain.flatten(true);
+	float parallel_time = timer.since();
+
+	EXPECT_EQ(tree.fwd.size(), sequential.fwd.size());
+	EXPECT_EQ(parallel.fwd.size(), sequential.fwd.size());
+	std::cout << "sequential *= " << sequential_time << "s" << std::endl;
+	std::cout << "tree flatten " << tree_time << "s" << std::endl;
+	std::cout << "parallel flatten " << parallel_time << "s" << std::endl;
+}
+
+TEST(MappingUnionTest, MatchesMapping) {
+	for (int identity = 0; identity < 2; identity++) {
+		srand(17 + identity);
+		Mapping<int> expect(-1, identity);
+		expect.set({{0, 3}, {1, 3}, {2, 7}});
+		MappingUnion<int> actual(expect);
+		for (int step = 0; step < 5000; step++) {
+			int from = rand()%60;
+			int to = rand()%8 == 0 ? -1 : rand()%60;
+			expect.update(from, to);
+			actual.update(from, to);
+
+			if (step%100 == 0) {
+				for (int i = -1; i < 62; i++) {
+					EXPECT_EQ(actual.map(i), expect.map(i));
+				}
+			}
+		}
+
+		Mapping<int> flat = actual.flatten();
+		EXPECT_EQ(flat.identity, expect.identity);
+		ASSERT_EQ(flat.fwd.size(), expect.fwd.size());
+		for (auto i = expect.fwd.begin(); i != expect.fwd.end(); i++) {
+			EXPECT_EQ(flat.map(i->first), i->second);
+		}
+	}
+}
+
+TEST(MappingBenchmark, DISABLED_UnionMerge) {
+	const int n = 20000;
+	srand(23);
+	std::vector<std::pair<int, int> > merges;
+	for (int i = 0; i < n; i++) {
+		merges.push_back({rand()%n, rand()%n});
+	}
+
+	Timer timer;
+	Mapping<int> plain(-1, true);
+	for (auto i = merges.begin(); i != merges.end(); i++) {
+		plain.update(i->first, i->second);
+	}
+	float plain_time = timer.since();
+
+	timer.reset();
+	MappingUnion<int> merged(-1, true);
+	for (auto i = merges.begin(); i != merges.end(); i++) {
+		merged.update(i->first, i->second);
+	}
+	Mapping<int> flat = merged.flatten();
+	float union_time = timer.since();
+
+	EXPECT_EQ(flat.fwd.size(), plain.fwd.size());
+	std::cout << "Mapping::update x" << n << ": " << plain_time << "s" << std::endl;
+	std::cout << "MappingUnion::update x" << n << " and flatten: " << union_time << "s" << std::endl;
+}
+
+TEST(MappingTest, BatchRemapMatchesMap) {
+	srand(29);
+	for (int identity = 0; identity < 2; identity++) {
+		Mapping<int> dense(-1, identity);
+		Mapping<long long> wide(-1, identity);
+		for (int i = 0; i < 300; i++) {
+			int from = rand()%400;
+			int to = rand()%10 == 0 ? -1 : rand()%500;
+			dense.set(from, to);
+			wide.set(from, to);
+		}
+
+		std::vector<int> ids;
+		std::vector<long long> wide_ids;
+		for (int i = 0; i < 1003; i++) {
+			ids.push_back(rand()%450 - 10);
+			wide_ids.push_back(ids.back());
+		}
+
+		std::vector<int> expect;
+		for (auto i = ids.begin(); i != ids.end(); i++) {
+			auto pos = dense.fwd.find(*i);
+			if (pos != dense.fwd.end() ? pos->second != -1 : identity) {
+				expect.push_back(dense.map(*i));
+			}
+		}
+
+		std::vector<int> result;
+		dense.mapInto(ids, result);
+		EXPECT_EQ(result, expect);
+		EXPECT_EQ(dense.map(ids), expect);
+
+		std::vector<long long> wide_result = wide.map(wide_ids);
+		EXPECT_EQ(std::vector<int>(wide_result.begin(), wide_result.end()), expect);
+
+		size_t count = dense.mapInPlace(ids);
+		ids.resize(count);
+		EXPECT_EQ(ids, expect);
+
+		std::vector<int> uniq = expect;
+		std::sort(uniq.begin(), uniq.end());
+		uniq.erase(std::unique(uniq.begin(), uniq.end()), uniq.end());
+		std::vector<int> original(wide_ids.begin(), wide_ids.end());
+		dense.mapUniqInto(original, result);
+		EXPECT_EQ(result, uniq);
+		EXPECT_EQ(dense.mapUniq(original), uniq);
+	}
+}
+
+TEST(MappingBenchmark, DISABLED_BatchRemap) {
+	const int n = 10000000;
+	Mapping<int> m(-1, false);
+	std::vector<int> ids(n);
+	for (int i = 0; i < n; i++) {
+		m.set(i, (int)(((long long)i*7919)%n));
+		ids[i] = (int)(((long long)i*104729)%n);
+	}
+
+	Timer timer;
+	size_t total = 0;
+	for (int r = 0; r < 5; r++) {
+		total += m.map(ids).size();
+	}
+	float map_time = timer.since();
+
+	std::vector<int> result;
+	timer.reset();
+	for (int r = 0; r < 5; r++) {
+		m.mapInto(ids, result);
+		total += result.size();
+	}
+	float into_time = timer.since();
+
+	timer.reset();
+	std::vector<int> scalar;
+	for (int r = 0; r < 5; r++) {
+		scalar.clear();
+		for (int i = 0; i < n; i++) {
+			auto pos = m.fwd.find(ids[i]);
+			if (pos != m.fwd.end() and pos->second != -1) {
+				scalar.push_back(pos->second);
+			}
+		}
+		total += scalar.size();
+	}
+	float scalar_time = timer.since();
+
+	EXPECT_EQ(result, scalar);
+	EXPECT_EQ(total, (size_t)15*n);
+	std::cout << "map(vector) x5: " << map_time << "s" << std::endl;
+	std::cout << "mapInto x5:     " << into_time << "s" << std::endl;
+	std::cout << "scalar find x5: " << scalar_time << "s" << std::endl;
+}
+
+TEST(PermutationTest, InverseComposeCycles) {
+	Permutation<int> p({1, 2, 0, 4, 3, 5});
+	Permutation<int> inv = p.inverse();
+	EXPECT_TRUE((p*inv).isIdentity());
+	EXPECT_TRUE((inv*p).isIdentity());
+
+	std::vector<std::vector<int> > cycles = p.cycles();
+	EXPECT_EQ(cycles, (std::vector<std::vector<int> >{{0, 1, 2}, {3, 4}}));
+
+	Permutation<int> q({5, 4, 3, 2, 1, 0});
+	Permutation<int> pq = p*q;
+	for (int i = 0; i < 6; i++) {
+		EXPECT_EQ(pq.map(i), q.map(p.map(i)));
+	}
+}
+
+TEST(PermutationTest, ApplyInPlace) {
+	srand(31);
+	const int n = 1000;
+	std::vector<int> order(n);
+	for (int i = 0; i < n; i++) {
+		order[i] = i;
+	}
+	for (int i = n-1; i > 0; i--) {
+		std::swap(order[i], order[rand()%(i+1)]);
+	}
+	Permutation<int> p(order);
+
+	std::vector<int> a(n);
+	std::vector<std::string> b(n);
+	for (int i = 0; i < n; i++) {
+		a[i] = i*3;
+		b[i] = std::to_string(i);
+	}
+	p.apply(a, b);
+	for (int i = 0; i < n; i++) {
+		EXPECT_EQ(a[p.map(i)], i*3);
+		EXPECT_EQ(b[p.map(i)], std::to_string(i));
+	}
+}
+
+TEST(PermutationTest, MappingRoundTrip) {
+	Permutation<int> p({2, 0, 1, 3});
+	Mapping<int> m = p.toMapping(-1);
+	EXPECT_EQ(m.fwd.size(), 3u);
+	EXPECT_FALSE(m.isBijective());
+	for (int i = 0; i < 4; i++) {
+		EXPECT_EQ(m.map(i), p.map(i));
+	}
+
+	Permutation<int> back(m, 4);
+	EXPECT_EQ(back.to, p.to);
+	EXPECT_EQ(Permutation<int>(m.flip(), 4).to, p.inverse().to);
+
+	// Every id must land in [0, n). A mapping that drops an id, or sends it
+	// out of range, is reported rather than read as undef.
+	Mapping<int> dropped(-1, false);
+	dropped.set(0, 1);
+	dropped.set(1, 0);
+	Mapping<int> outside(-1, false);
+	outside.set(0, 1);
+	outside.set(1, 0);
+	outside.set(2, 7);
+	for (const Mapping<int> *bad : {&dropped, &outside}) {
+		testing::internal::CaptureStdout();
+		Permutation<int> q(*bad, 3);
+		std::string output = testing::internal::GetCapturedStdout();
+		EXPECT_NE(output.find("internal failure"), std::string::npos);
+	}
+}
+
+TEST(MappingBenchmark, DISABLED_PermutationInverse) {
+	const int n = 2000000;
+	std::vector<int> order(n);
+	for (int i = 0; i < n; i++) {
+		order[i] = (int)(((long long)i*7919)%n);
+	}
+	Permutation<int> p(order);
+	Mapping<int> m = p.toMapping(-1);
+
+	Timer timer;
+	Mapping<int> flipped = m.flip();
+	float flip_time = timer.since();
+
+	timer.reset();
+	Permutation<int> inv = p.inverse();
+	float inverse_time = timer.since();
+
+	std::vector<int> a(n), b(n), c(n);
+	timer.reset();
+	p.apply(a, b, c);
+	float apply_time = timer.since();
+
+	EXPECT_EQ(flipped.map(7919), inv.map(7919));
+	std::cout << "Mapping::flip " << flip_time << "s" << std::endl;
+	std::cout << "Permutation::inverse " << inverse_time << "s" << std::endl;
+	std::cout << "Permutation::apply to 3 arrays " << apply_time << "s" << std::endl;
+}
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include <common/soa_index_vector.h>
+#include <common/timer.h>
+#include <array>
+#include <string>
+#include <vector>
+
+TEST(SoaIndexVectorTest, SlotsMatchIndexVector) {
+	soa_index_vector<int, std::string> v;
+	index_vector<int> ref;
+	for (int i = 0; i < 100; i++) {
+		EXPECT_EQ(v.emplace(i, std::to_string(i)), ref.emplace(i));
+	}
+	for (int i = 0; i < 100; i += 7) {
+		EXPECT_EQ(v.erase(i), ref.erase(i));
+	}
+	EXPECT_FALSE(v.erase(0));
+	EXPECT_EQ(v.count(), ref.count());
+	EXPECT_EQ(v.next_index(), ref.next_index());
+	EXPECT_EQ(v.emplace(-1, "x"), ref.emplace(-1));
+	EXPECT_THROW(v.get<0>(7), std::out_of_range);
+
+	EXPECT_EQ(v.get<1>(0), "x");
+	v.get<0>(3) = 30;
+	auto [a, b] = v[3];
+	EXPECT_EQ(a, 30);
+	EXPECT_EQ(b, "3");
+
+	v.emplace_at(150, 150, "far");
+	EXPECT_EQ(v.size(), 151u);
+	EXPECT_EQ(v.get<1>(150), "far");
+	EXPECT_EQ(v.insert({5, "five"}), 7u);
+}
+
+TEST(SoaIndexVectorTest, ColumnIteration) {
+	soa_index_vector<int, double, std::string> v;
+	for (int i = 0; i < 1000; i++) {
+		v.emplace(i, i*0.5, "");
+	}
+	for (int i = 0; i < 1000; i++) {
+		if (i%3 == 0) {
+			v.erase(i);
+		}
+	}
+
+	long long total = 0;
+	int seen = 0;
+	v.for_each<0>([&](int x) { total += x; seen++; });
+	long long expect = 0;
+	for (int i = 0; i < 1000; i++) {
+		expect += i%3 == 0 ? 0 : i;
+	}
+	EXPECT_EQ(total, expect);
+	EXPECT_EQ(seen, 666);
+
+	v.for_each<1, 0>([](double &d, int x) { d += x; });
+	EXPECT_EQ(v.get<1>(4), 6.0);
+
+	std::vector<size_t> indices;
+	v.for_each_indexed<>([&](size_t i) { indices.push_back(i); });
+	EXPECT_EQ(indices.size(), 666u);
+	EXPECT_EQ(indices[0], 1u);
+	EXPECT_EQ(indices.back(), 998u);
+
+	Mapping<size_t> m = v.compact();
+	EXPECT_EQ(v.size(), 666u);
+	EXPECT_EQ(m.map(998), 665u);
+	EXPECT_EQ(v.get<0>(665), 998);
+}
+
+TEST(IndexVectorBenchmark, DISABLED_SoaColumnScan) {
+	struct wide {
+		int id;
+		double weight;
+		char payload[112];
+	};
+
+	const int n = 2000000;
+	index_vector<wide> aos;
+	soa_index_vector<int, double, std::array<char, 112> > soa;
+	for (int i = 0; i < n; i++) {
+		aos.emplace(wide{i, 1.0, {}});
+		soa.emplace(i, 1.0, std::array<char, 112>{});
+	}
+	for (int i = 0; i < n; i += 10) {
+		aos.erase(i);
+		soa.erase(i);
+	}
+
+	Timer timer;
+	long long aos_total = 0;
+	for (int pass = 0; pass < 10; pass++) {
+		for (auto i = aos.begin(); i != aos.end(); i++) {
+			aos_total += i->id;
+		}
+	}
+	float aos_time = timer.since();
+
+	timer.reset();
+	long long soa_total = 0;
+	for (int pass = 0; pass < 10; pass++) {
+		soa.for_each<0>([&](int id) { soa_total += id; });
+	}
+	float soa_time = timer.since();
+
+	EXPECT_EQ(aos_total, soa_total);
+	std::cout << "sum one field of 128-byte elements x10: index_vector " << aos_time << "s, soa_index_vector " << soa_time << "s" << std::endl;
+}